@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/buffer.h"
+#include "helpers/threadpool.h"
+#include "helpers/hash.h"
+
+#define BATCH_INITIAL_OUTPUT_SLOTS 64
+
+static double batch_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// foo.c becomes foo.o, anything without an extension gets .o appended
+static char *batch_out_filename_for(const char *filename)
+{
+    const char *dot = strrchr(filename, '.');
+    const char *slash = strrchr(filename, '/');
+    size_t stem_len = (dot && (!slash || dot > slash)) ? (size_t)(dot - filename) : strlen(filename);
+    char *out_filename = malloc(stem_len + sizeof(".o"));
+    memcpy(out_filename, filename, stem_len);
+    strcpy(out_filename + stem_len, ".o");
+    return out_filename;
+}
+
+// The slot holding out_filename, or the empty one it would go in
+static int batch_output_slot(struct batch *batch, const char *out_filename)
+{
+    int slot = hash_string(out_filename, strlen(out_filename)) & (batch->total_output_slots - 1);
+    while (batch->outputs[slot].out_filename && !S_EQ(batch->outputs[slot].out_filename, out_filename))
+    {
+        slot = (slot + 1) & (batch->total_output_slots - 1);
+    }
+    return slot;
+}
+
+static void batch_grow_outputs(struct batch *batch)
+{
+    struct batch_output *outputs = batch->outputs;
+    int total_slots = batch->total_output_slots;
+    batch->total_output_slots = total_slots * 2;
+    batch->outputs = calloc(batch->total_output_slots, sizeof(struct batch_output));
+    for (int i = 0; i < total_slots; i++)
+    {
+        if (outputs[i].out_filename)
+        {
+            batch->outputs[batch_output_slot(batch, outputs[i].out_filename)] = outputs[i];
+        }
+    }
+    free(outputs);
+}
+
+struct batch *batch_create(int total_threads, int flags)
+{
+    struct batch *batch = calloc(1, sizeof(struct batch));
+    batch->files = vector_create(sizeof(struct batch_file));
+    batch->outputs = calloc(BATCH_INITIAL_OUTPUT_SLOTS, sizeof(struct batch_output));
+    batch->total_output_slots = BATCH_INITIAL_OUTPUT_SLOTS;
+    batch->total_threads = total_threads > 0 ? total_threads : threadpool_total_processors();
+    batch->flags = flags;
+    return batch;
+}
+
+void batch_free(struct batch *batch)
+{
+    for (int i = 0; i < vector_count(batch->files); i++)
+    {
+        struct batch_file *file = vector_at(batch->files, i);
+        free((void *)file->filename);
+        free(file->out_filename);
+    }
+    vector_free(batch->files);
+    free(batch->outputs);
+    free(batch);
+}
+
+int batch_add_file(struct batch *batch, const char *filename)
+{
+    if ((vector_count(batch->files) + 1) * 2 > batch->total_output_slots)
+    {
+        batch_grow_outputs(batch);
+    }
+
+    char *out_filename = batch_out_filename_for(filename);
+    int slot = batch_output_slot(batch, out_filename);
+    if (batch->outputs[slot].out_filename)
+    {
+        fprintf(stderr, "%s and %s would both be compiled to %s\n", batch->outputs[slot].filename, filename, out_filename);
+        free(out_filename);
+        return -1;
+    }
+
+    struct batch_file file = {0};
+    file.filename = strdup(filename);
+    file.out_filename = out_filename;
+    file.result = COMPILER_FILE_COMPILE_FAILED;
+
+    struct stat st;
+    if (stat(filename, &st) == 0)
+    {
+        file.size = st.st_size;
+    }
+    vector_push(batch->files, &file);
+    batch->outputs[slot] = (struct batch_output){.out_filename = file.out_filename, .filename = file.filename};
+    return 0;
+}
+
+// Response files list one input per whitespace separated word, like @files for gcc.
+int batch_add_response_file(struct batch *batch, const char *filename)
+{
+    FILE *fp = fopen(filename, "r");
+    if (!fp)
+    {
+        fprintf(stderr, "Unable to read response file %s\n", filename);
+        return -1;
+    }
+
+    int res = 0;
+    struct buffer *word = buffer_create();
+    int c = fgetc(fp);
+    while (res == 0)
+    {
+        if (c == EOF || c == ' ' || c == '\t' || c == '\n' || c == '\r')
+        {
+            if (word->len)
+            {
+                buffer_write(word, '\0');
+                res = batch_add_file(batch, buffer_ptr(word));
+                word->len = 0;
+            }
+
+            if (c == EOF)
+            {
+                break;
+            }
+        }
+        else
+        {
+            buffer_write(word, c);
+        }
+        c = fgetc(fp);
+    }
+
+    buffer_free(word);
+    fclose(fp);
+    return res;
+}
+
+struct batch_job
+{
+    struct batch *batch;
+    struct batch_file *file;
+};
+
+static void batch_compile_job(void *arg)
+{
+    struct batch_job *job = arg;
+    struct batch_file *file = job->file;
+    double start = batch_now();
+    file->result = compile_file_with_stats(file->filename, file->out_filename, job->batch->flags, &job->batch->options, &file->stats);
+    file->seconds = batch_now() - start;
+}
+
+static int batch_file_compare_size_descending(const void *a, const void *b)
+{
+    const struct batch_file *file_a = a;
+    const struct batch_file *file_b = b;
+    if (file_a->size == file_b->size)
+    {
+        return 0;
+    }
+    return file_a->size > file_b->size ? -1 : 1;
+}
+
+int batch_compile(struct batch *batch)
+{
+    int total_files = vector_count(batch->files);
+
+    // Largest first, so the longest compiles don't end up as stragglers.
+    qsort(vector_data_ptr(batch->files), total_files, sizeof(struct batch_file), batch_file_compare_size_descending);
+
+    int total_threads = batch->total_threads < total_files ? batch->total_threads : total_files;
+    struct batch_job *jobs = calloc(total_files, sizeof(struct batch_job));
+    double start = batch_now();
+    if (total_threads > 0)
+    {
+        struct threadpool *pool = threadpool_create(total_threads);
+        for (int i = 0; i < total_files; i++)
+        {
+            jobs[i].batch = batch;
+            jobs[i].file = vector_at(batch->files, i);
+            threadpool_submit(pool, batch_compile_job, &jobs[i]);
+        }
+        threadpool_free(pool);
+    }
+    batch->seconds = batch_now() - start;
+    free(jobs);
+
+    batch->total_failed = 0;
+    for (int i = 0; i < total_files; i++)
+    {
+        struct batch_file *file = vector_at(batch->files, i);
+        if (file->result != COMPILER_FILE_COMPILE_SUCCESS)
+        {
+            batch->total_failed++;
+        }
+    }
+
+    return batch->total_failed ? COMPILER_FILE_COMPILE_FAILED : COMPILER_FILE_COMPILE_SUCCESS;
+}
+
+void batch_print_summary(struct batch *batch, FILE *out)
+{
+    int total_files = vector_count(batch->files);
+    for (int i = 0; i < total_files; i++)
+    {
+        struct batch_file *file = vector_at(batch->files, i);
+        fprintf(out, "%-6s %10zu bytes %10.3f ms  memory %zu/%zu bytes (lex/parse)  %zu parse allocations  ast %zu bytes  %s\n",
+                file->result == COMPILER_FILE_COMPILE_SUCCESS ? "OK" : "FAILED",
+                file->size, file->seconds * 1000,
+                file->stats.lex_bytes, file->stats.parse_bytes, file->stats.parse_allocations, file->stats.ast_bytes, file->filename);
+    }
+
+    fprintf(out, "%i files, %i succeeded, %i failed, %i threads, %.3f ms\n",
+            total_files, total_files - batch->total_failed, batch->total_failed,
+            batch->total_threads, batch->seconds * 1000);
+
+    if (batch->options.token_cache_dir)
+    {
+        int total_hits = 0;
+        for (int i = 0; i < total_files; i++)
+        {
+            struct batch_file *file = vector_at(batch->files, i);
+            total_hits += file->stats.token_cache_hit;
+        }
+        fprintf(out, "token cache: %i hits, %i misses\n", total_hits, total_files - total_hits);
+    }
+
+    if (batch->options.compile_cache_dir)
+    {
+        int total_hits = 0;
+        for (int i = 0; i < total_files; i++)
+        {
+            struct batch_file *file = vector_at(batch->files, i);
+            total_hits += file->stats.compile_cache_hit;
+        }
+        fprintf(out, "compile cache: %i hits, %i misses\n", total_hits, total_files - total_hits);
+    }
+}
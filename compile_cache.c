@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/hash.h"
+
+/*
+ * Compiled outputs saved to disk, keyed on everything that goes into them.
+ *
+ * The key is a SHA-256 of the compiler binary's identity, the flags and
+ * options that change what comes out and the input's bytes, so an input seen
+ * before under the same build of the compiler is never lexed or parsed again,
+ * its old output is just copied. Outputs are written under a temporary name
+ * and renamed into place, so compiles sharing the directory never see half
+ * of one. Each hit sets the file's modification time, and once the directory
+ * grows past its size the outputs that went longest without one are removed.
+ */
+
+#define COMPILE_CACHE_OUTPUT_SUFFIX ".out"
+#define COMPILE_CACHE_OUTPUT_NAME_SIZE (COMPILE_CACHE_KEY_SIZE - 1 + sizeof(COMPILE_CACHE_OUTPUT_SUFFIX))
+
+struct compile_cache_entry
+{
+    char name[COMPILE_CACHE_OUTPUT_NAME_SIZE];
+    off_t size;
+    struct timespec used;
+};
+
+// Which build of the compiler is running, a rebuild changes its size or modification time
+static struct
+{
+    pthread_once_t once;
+    bool known;
+    dev_t device;
+    ino_t inode;
+    off_t size;
+    struct timespec modified;
+} compile_cache_compiler = {.once = PTHREAD_ONCE_INIT};
+
+static atomic_uint compile_cache_total_temp_files;
+
+static void compile_cache_identify_compiler(void)
+{
+    struct stat st;
+    if (stat("/proc/self/exe", &st) != 0)
+    {
+        return;
+    }
+
+    compile_cache_compiler.device = st.st_dev;
+    compile_cache_compiler.inode = st.st_ino;
+    compile_cache_compiler.size = st.st_size;
+    compile_cache_compiler.modified = st.st_mtim;
+    compile_cache_compiler.known = true;
+}
+
+bool compile_cache_begin_key(struct hash_sha256 *sha)
+{
+    pthread_once(&compile_cache_compiler.once, compile_cache_identify_compiler);
+    if (!compile_cache_compiler.known)
+    {
+        return false;
+    }
+
+    hash_sha256_begin(sha);
+    uint64_t compiler[] = {
+        compile_cache_compiler.device,
+        compile_cache_compiler.inode,
+        compile_cache_compiler.size,
+        compile_cache_compiler.modified.tv_sec,
+        compile_cache_compiler.modified.tv_nsec,
+    };
+    hash_sha256_update(sha, compiler, sizeof(compiler));
+    return true;
+}
+
+void compile_cache_end_key(struct hash_sha256 *sha, struct compile_process *process, char *key)
+{
+    uint64_t source_size = process->cfile.size;
+    hash_sha256_update(sha, &source_size, sizeof(source_size));
+    hash_sha256_update(sha, process->cfile.data, process->cfile.size);
+
+    unsigned char digest[HASH_SHA256_SIZE];
+    hash_sha256_end(sha, digest);
+    for (int i = 0; i < HASH_SHA256_SIZE; i++)
+    {
+        snprintf(key + i * 2, 3, "%02x", digest[i]);
+    }
+}
+
+bool compile_cache_key(struct compile_process *process, int flags, struct compile_options *options, char *key)
+{
+    struct hash_sha256 sha;
+    if (!compile_cache_begin_key(&sha))
+    {
+        return false;
+    }
+
+    hash_sha256_update(&sha, &flags, sizeof(flags));
+    // Whether a deep expression compiles at all depends on it
+    int max_expression_depth = options ? options->max_expression_depth : 0;
+    hash_sha256_update(&sha, &max_expression_depth, sizeof(max_expression_depth));
+    compile_cache_end_key(&sha, process, key);
+    return true;
+}
+
+static char *compile_cache_path(const char *directory, const char *key)
+{
+    size_t size = strlen(directory) + 1 + COMPILE_CACHE_OUTPUT_NAME_SIZE;
+    char *path = malloc(size);
+    snprintf(path, size, "%s/%s" COMPILE_CACHE_OUTPUT_SUFFIX, directory, key);
+    return path;
+}
+
+// Reads all of fd, NULL if it couldn't be
+static char *compile_cache_read(int fd, size_t *size_out)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    char *data = malloc(size ? size : 1);
+    size_t total_read = 0;
+    while (total_read < size)
+    {
+        ssize_t res = read(fd, data + total_read, size - total_read);
+        if (res <= 0)
+        {
+            free(data);
+            return NULL;
+        }
+        total_read += res;
+    }
+    *size_out = size;
+    return data;
+}
+
+/*
+ * Writes data into directory under key. The file is created 0644 less the
+ * umask, so a directory shared between users gets hits from everyone's outputs.
+ */
+static int compile_cache_write(const char *directory, const char *key, const char *data, size_t size)
+{
+    size_t path_size = strlen(directory) + COMPILE_CACHE_KEY_SIZE + sizeof("/..4294967295.4294967295");
+    char *temp_path = malloc(path_size);
+    int fd = -1;
+    for (int attempt = 0; fd < 0 && attempt < 8; attempt++)
+    {
+        // Only a file left over by a process that had the same pid can be in the way
+        snprintf(temp_path, path_size, "%s/.%s.%u.%u", directory, key, (unsigned)getpid(),
+                 atomic_fetch_add(&compile_cache_total_temp_files, 1));
+        fd = open(temp_path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    }
+    if (fd < 0)
+    {
+        free(temp_path);
+        return -1;
+    }
+
+    size_t total_written = 0;
+    while (total_written < size)
+    {
+        ssize_t res = write(fd, data + total_written, size - total_written);
+        if (res <= 0)
+        {
+            break;
+        }
+        total_written += res;
+    }
+    bool written = close(fd) == 0 && total_written == size;
+
+    char *path = compile_cache_path(directory, key);
+    int res = written && rename(temp_path, path) == 0 ? 0 : -1;
+    if (res != 0)
+    {
+        unlink(temp_path);
+    }
+    free(path);
+    free(temp_path);
+    return res;
+}
+
+bool compile_cache_fetch(const char *directory, const char *key, FILE *out)
+{
+    char *path = compile_cache_path(directory, key);
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    // Read all of it first, so that out is untouched if anything goes wrong
+    size_t size = 0;
+    char *data = compile_cache_read(fd, &size);
+    bool fetched = data && fwrite(data, 1, size, out) == size;
+    if (fetched && futimens(fd, NULL) != 0)
+    {
+        // Only the owner may mark someone else's output used, so it becomes ours instead
+        compile_cache_write(directory, key, data, size);
+    }
+    free(data);
+    close(fd);
+    return fetched;
+}
+
+static int compile_cache_entry_compare(const void *a, const void *b)
+{
+    const struct timespec *used_a = &((const struct compile_cache_entry *)a)->used;
+    const struct timespec *used_b = &((const struct compile_cache_entry *)b)->used;
+    if (used_a->tv_sec != used_b->tv_sec)
+    {
+        return used_a->tv_sec < used_b->tv_sec ? -1 : 1;
+    }
+    if (used_a->tv_nsec != used_b->tv_nsec)
+    {
+        return used_a->tv_nsec < used_b->tv_nsec ? -1 : 1;
+    }
+    return 0;
+}
+
+static bool compile_cache_is_output(const char *name)
+{
+    size_t len = strlen(name);
+    size_t suffix_len = sizeof(COMPILE_CACHE_OUTPUT_SUFFIX) - 1;
+    return len == COMPILE_CACHE_OUTPUT_NAME_SIZE - 1 && name[0] != '.' &&
+           S_EQ(name + len - suffix_len, COMPILE_CACHE_OUTPUT_SUFFIX);
+}
+
+static void compile_cache_evict(const char *directory, size_t max_size)
+{
+    DIR *dir = opendir(directory);
+    if (!dir)
+    {
+        return;
+    }
+
+    struct vector *entries = vector_create(sizeof(struct compile_cache_entry));
+    size_t total_size = 0;
+    struct dirent *dirent;
+    while ((dirent = readdir(dir)) != NULL)
+    {
+        struct stat st;
+        if (!compile_cache_is_output(dirent->d_name) ||
+            fstatat(dirfd(dir), dirent->d_name, &st, 0) != 0)
+        {
+            continue;
+        }
+
+        struct compile_cache_entry entry = {.size = st.st_size, .used = st.st_mtim};
+        strcpy(entry.name, dirent->d_name);
+        vector_push(entries, &entry);
+        total_size += st.st_size;
+    }
+
+    if (total_size > max_size)
+    {
+        qsort(vector_data_ptr(entries), vector_count(entries), sizeof(struct compile_cache_entry), compile_cache_entry_compare);
+        for (int i = 0; i < vector_count(entries) && total_size > max_size; i++)
+        {
+            // Another compile may have evicted it already, it is gone either way
+            struct compile_cache_entry *entry = vector_at(entries, i);
+            unlinkat(dirfd(dir), entry->name, 0);
+            total_size -= entry->size;
+        }
+    }
+
+    vector_free(entries);
+    closedir(dir);
+}
+
+int compile_cache_store(const char *directory, const char *key, const char *out_filename, size_t max_size)
+{
+    int fd = open(out_filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    size_t size = 0;
+    char *data = compile_cache_read(fd, &size);
+    close(fd);
+    int res = data ? compile_cache_write(directory, key, data, size) : -1;
+    free(data);
+
+    compile_cache_evict(directory, max_size ? max_size : COMPILE_CACHE_DEFAULT_MAX_SIZE);
+    return res;
+}
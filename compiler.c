@@ -1,27 +1,43 @@
 #include <stdarg.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 #include "compiler.h"
+#include "helpers/arena.h"
 
 struct lex_process_functions compiler_lex_process_functions =
 {
     .next_char = compile_process_next_char,
     .peek_char = compile_process_peek_char,
     .push_char = compile_process_push_char,
+    .input_span = compile_process_input_span,
+    .skip_chars = compile_process_skip_chars,
 };
 
 void compiler_error(struct compile_process *compiler, const char *message, ...)
 {
-    va_list args;
-    va_start(args, message);
-    vfprintf(stderr, message, args);
-    va_end(args);
-    fprintf(stderr, " on line %i, column %i, in file %s\n", compiler->pos.line, compiler->pos.col, compiler->pos.filename);
+    if (!(compiler->flags & COMPILE_PROCESS_FLAG_SPECULATIVE))
+    {
+        va_list args;
+        va_start(args, message);
+        vfprintf(stderr, message, args);
+        va_end(args);
+        fprintf(stderr, " on line %i, column %i, in file %s\n", compiler->pos.line, compiler->pos.col, compiler->pos.filename);
+    }
+    if (compiler->error_recovery)
+    {
+        longjmp(*compiler->error_recovery, 1);
+    }
     exit(-1);
 }
 
 void compiler_warning(struct compile_process *compiler, const char *message, ...)
 {
+    if (compiler->flags & COMPILE_PROCESS_FLAG_SPECULATIVE)
+    {
+        return;
+    }
+
     va_list args;
     va_start(args, message);
     vfprintf(stderr, message, args);
@@ -29,7 +45,167 @@ void compiler_warning(struct compile_process *compiler, const char *message, ...
     fprintf(stderr, " on line %i, column %i, in file %s\n", compiler->pos.line, compiler->pos.col, compiler->pos.filename);
 }
 
-int compile_file(const char *filename, const char *out_filename, int flags)
+/*
+ * A lexer running on its own thread, ahead of the parser.
+ *
+ * It works on its own copy of the compile process, so the position it keeps
+ * for error messages, the arena its strings come from and the jmp_buf
+ * compiler_error returns to are all its own. The input itself is shared, it
+ * is only ever read.
+ */
+struct compile_lexer_thread
+{
+    struct compile_process view;
+    struct lex_process *lex_process;
+    struct token_queue *queue;
+    pthread_t thread;
+    bool joined;
+};
+
+static void *compile_lexer_thread_run(void *private)
+{
+    struct compile_lexer_thread *lexer_thread = private;
+    jmp_buf error_recovery;
+    if (setjmp(error_recovery))
+    {
+        token_queue_close(lexer_thread->queue, true);
+        return NULL;
+    }
+    lexer_thread->view.error_recovery = &error_recovery;
+
+    struct token token;
+    uint32_t offset;
+    lex_begin(lexer_thread->lex_process);
+    while (lex_next_token(lexer_thread->lex_process, &token, &offset))
+    {
+        if (!token_queue_push(lexer_thread->queue, &token, offset))
+        {
+            break;
+        }
+    }
+    token_queue_close(lexer_thread->queue, false);
+    return NULL;
+}
+
+static struct compile_lexer_thread *compile_lexer_thread_start(struct compile_process *process)
+{
+    struct compile_lexer_thread *lexer_thread = calloc(1, sizeof(struct compile_lexer_thread));
+    lexer_thread->view = *process;
+    lexer_thread->view.arena = arena_create(ARENA_DEFAULT_CHUNK_SIZE);
+    process->lex_arena = lexer_thread->view.arena;
+
+    lexer_thread->lex_process = lex_process_create(&lexer_thread->view, &compiler_lex_process_functions, NULL);
+    lexer_thread->queue = token_queue_create();
+    if (!lexer_thread->lex_process || !lexer_thread->queue)
+    {
+        goto out_err;
+    }
+    lexer_thread->lex_process->flags |= LEX_PROCESS_FLAG_NO_TOKEN_STORE;
+
+    if (pthread_create(&lexer_thread->thread, NULL, compile_lexer_thread_run, lexer_thread) != 0)
+    {
+        goto out_err;
+    }
+    return lexer_thread;
+
+out_err:
+    if (lexer_thread->lex_process)
+    {
+        lex_process_free(lexer_thread->lex_process);
+    }
+    if (lexer_thread->queue)
+    {
+        token_queue_free(lexer_thread->queue);
+    }
+    free(lexer_thread);
+    return NULL;
+}
+
+// Waits for the lexer to stop, telling it to if the parser gave up first. False if the lexer failed.
+static bool compile_lexer_thread_join(struct compile_lexer_thread *lexer_thread)
+{
+    if (!lexer_thread->joined)
+    {
+        token_queue_cancel(lexer_thread->queue);
+        pthread_join(lexer_thread->thread, NULL);
+        lexer_thread->joined = true;
+    }
+    return !token_queue_failed(lexer_thread->queue);
+}
+
+static void compile_lexer_thread_free(struct compile_lexer_thread *lexer_thread)
+{
+    compile_lexer_thread_join(lexer_thread);
+    lex_process_free(lexer_thread->lex_process);
+    token_queue_free(lexer_thread->queue);
+    free(lexer_thread);
+}
+
+// Everything the parser allocates from, for counting what a parse allocated
+static size_t compile_parse_allocations(struct compile_process *process)
+{
+    return process->arena->total_allocations +
+           process->ast.total_allocations +
+           process->node_vec->total_allocations +
+           process->node_tree_vec->total_allocations +
+           process->parser.exp_stack->total_allocations;
+}
+
+static void compile_file_finish(struct compile_process *process, struct lex_process *lex_process, struct compile_stats *stats)
+{
+    // Before anything it might still be using is looked at
+    struct lex_process *lexer = lex_process;
+    if (process->lexer_thread)
+    {
+        compile_lexer_thread_join(process->lexer_thread);
+        lexer = process->lexer_thread->lex_process;
+    }
+
+    if (stats)
+    {
+        process->stats.arena_allocations = process->arena->total_allocations;
+        if (process->lex_arena)
+        {
+            process->stats.arena_allocations += process->lex_arena->total_allocations;
+            process->stats.lex_bytes = arena_used(process->lex_arena);
+        }
+        // Spellings the parser interns are few, the pool is the lexer's
+        if (lexer)
+        {
+            process->stats.lex_bytes += token_store_memory_usage(lexer->token_store) +
+                                        vector_memory_usage(lexer->brackets) +
+                                        intern_pool_memory_usage(process->intern_pool);
+        }
+        process->stats.ast_bytes = ast_memory_usage(&process->ast);
+        process->stats.parse_bytes += process->stats.ast_bytes +
+                                      vector_memory_usage(process->node_vec) +
+                                      vector_memory_usage(process->node_tree_vec) +
+                                      vector_memory_usage(process->parser.exp_stack);
+        if (process->token_stream)
+        {
+            process->stats.parse_bytes += token_stream_memory_usage(process->token_stream);
+        }
+        *stats = process->stats;
+    }
+
+    if (process->lexer_thread)
+    {
+        compile_lexer_thread_free(process->lexer_thread);
+        process->lexer_thread = NULL;
+    }
+
+    if (process->token_stream)
+    {
+        token_stream_free(process->token_stream);
+    }
+    if (lex_process)
+    {
+        lex_process_free(lex_process);
+    }
+    compile_process_free(process);
+}
+
+int compile_file_with_stats(const char *filename, const char *out_filename, int flags, struct compile_options *options, struct compile_stats *stats)
 {
     struct compile_process* process = compile_process_create(filename, out_filename, flags);
 
@@ -38,27 +214,132 @@ int compile_file(const char *filename, const char *out_filename, int flags)
         return COMPILER_FILE_COMPILE_FAILED;
     }
 
-    // Perform lexical analysis
-    struct lex_process* lex_process = lex_process_create(process, &compiler_lex_process_functions, NULL);
-    if (!lex_process)
+    if (options && options->max_expression_depth > 0)
     {
-        return COMPILER_FILE_COMPILE_FAILED;
+        process->parser.max_expression_depth = options->max_expression_depth;
     }
 
-    if (lex(lex_process) != LEX_SUCCESS)
+    const char *token_cache_dir = options ? options->token_cache_dir : NULL;
+    char token_key[TOKEN_CACHE_KEY_SIZE];
+    if (token_cache_dir && !token_cache_key(process, token_key))
     {
+        token_cache_dir = NULL;
+    }
+    char compile_key[COMPILE_CACHE_KEY_SIZE];
+    const char *compile_cache_dir = options && process->ofile ? options->compile_cache_dir : NULL;
+    if (compile_cache_dir && !compile_cache_key(process, flags, options, compile_key))
+    {
+        compile_cache_dir = NULL;
+    }
+    if (compile_cache_dir && compile_cache_fetch(compile_cache_dir, compile_key, process->ofile))
+    {
+        process->stats.compile_cache_hit = true;
+        compile_file_finish(process, NULL, stats);
+        return COMPILER_FILE_COMPILE_SUCCESS;
+    }
+
+    // Written after the setjmp and read after a longjmp, so it must be volatile.
+    struct lex_process *volatile lex_process = NULL;
+    jmp_buf error_recovery;
+    if (setjmp(error_recovery))
+    {
+        // compiler_error was called somewhere below
+        compile_file_finish(process, lex_process, stats);
         return COMPILER_FILE_COMPILE_FAILED;
     }
+    process->error_recovery = &error_recovery;
+
+    // Perform lexical analysis
+    if (flags & COMPILE_PROCESS_FLAG_PIPELINE)
+    {
+        // The lexer starts on its own thread and the parser reads what it has made so far
+        process->lexer_thread = compile_lexer_thread_start(process);
+        if (!process->lexer_thread)
+        {
+            compile_file_finish(process, NULL, stats);
+            return COMPILER_FILE_COMPILE_FAILED;
+        }
+        // The lexer thread keeps no tokens in its store, the stream only looks up lines in it
+        process->token_store = process->lexer_thread->lex_process->token_store;
+        process->token_stream = token_stream_create_for_queue(process->lexer_thread->queue, process->token_store, TOKEN_STREAM_DEFAULT_CAPACITY);
+    }
+    else
+    {
+        lex_process = lex_process_create(process, &compiler_lex_process_functions, NULL);
+        if (!lex_process)
+        {
+            compile_file_finish(process, NULL, stats);
+            return COMPILER_FILE_COMPILE_FAILED;
+        }
 
-    process->tokens = lex_process->tokens;
+        if (flags & COMPILE_PROCESS_FLAG_STREAM_TOKENS)
+        {
+            // Nothing is lexed yet, the parser pulls tokens as it goes and the lexer's arena use counts as parsing
+            lex_process->flags |= LEX_PROCESS_FLAG_NO_TOKEN_STORE;
+            process->token_stream = token_stream_create(lex_process, TOKEN_STREAM_DEFAULT_CAPACITY);
+        }
+        else
+        {
+            process->stats.token_cache_hit = token_cache_dir && token_cache_load(lex_process, token_cache_dir, token_key);
+            if (!process->stats.token_cache_hit)
+            {
+                token_store_reserve(lex_process->token_store, process->cfile.size / COMPILER_BYTES_PER_TOKEN_ESTIMATE);
+                int lex_result = options && options->lex_threads > 1 ?
+                    lex_parallel(lex_process, options->lex_threads, 0) :
+                    lex(lex_process);
+                if (lex_result != LEX_SUCCESS)
+                {
+                    compile_file_finish(process, lex_process, stats);
+                    return COMPILER_FILE_COMPILE_FAILED;
+                }
+
+                // Only a lex that went through is worth keeping, and a cache that can't be written just means lexing next time too
+                if (token_cache_dir)
+                {
+                    token_cache_save(lex_process, token_cache_dir, token_key);
+                }
+            }
+        }
+        process->token_store = lex_process->token_store;
+        process->brackets = lex_process->brackets;
+    }
+    process->stats.lex_bytes = arena_used(process->arena);
 
     // Perform parsing
-    if (parse(process) != PARSE_SUCCESS)
+    size_t allocations_before_parse = compile_parse_allocations(process);
+    int parse_result = parse(process);
+    process->stats.parse_bytes = arena_used(process->arena) - process->stats.lex_bytes;
+    process->stats.parse_allocations = compile_parse_allocations(process) - allocations_before_parse;
+    if (process->lexer_thread)
+    {
+        // The parser ran out of tokens because the lexer stopped, which it may have done on an error
+        bool lexed = compile_lexer_thread_join(process->lexer_thread);
+        process->brackets = process->lexer_thread->lex_process->brackets;
+        if (!lexed)
+        {
+            compile_file_finish(process, NULL, stats);
+            return COMPILER_FILE_COMPILE_FAILED;
+        }
+    }
+    if (parse_result != PARSE_SUCCESS)
     {
+        compile_file_finish(process, lex_process, stats);
         return COMPILER_FILE_COMPILE_FAILED;
     }
 
     // Perform code generation
 
+    compile_file_finish(process, lex_process, stats);
+
+    // The output is complete once the process has closed it
+    if (compile_cache_dir)
+    {
+        compile_cache_store(compile_cache_dir, compile_key, out_filename, options->compile_cache_max_size);
+    }
     return 0;
 }
+
+int compile_file(const char *filename, const char *out_filename, int flags)
+{
+    return compile_file_with_stats(filename, out_filename, flags, NULL, NULL);
+}
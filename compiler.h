@@ -4,6 +4,9 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdatomic.h>
 
 #include "helpers/vector.h"
 
@@ -76,6 +79,52 @@ enum
     TOKEN_TYPE_NEWLINE,
 };
 
+enum
+{
+    KEYWORD_FLAG_DATATYPE = 1 << 0,
+    KEYWORD_FLAG_PRIMITIVE = 1 << 1,
+    KEYWORD_FLAG_MODIFIER = 1 << 2,  // const, static, unsigned...
+};
+
+enum
+{
+    KEYWORD_NONE,
+#define KEYWORD(id, str, flags) id,
+#include "keywords.def"
+#undef KEYWORD
+    KEYWORD_TOTAL,
+};
+
+struct keyword
+{
+    const char *str;
+    size_t len;
+    int flags;
+};
+
+enum
+{
+    OPERATOR_FLAG_LEXED = 1 << 0,  // read by the lexer as a single operator token
+};
+
+enum
+{
+    OPERATOR_NONE,
+#define OPERATOR(id, str, precedence, associativity, flags) id,
+#include "operators.def"
+#undef OPERATOR
+    OPERATOR_TOTAL,
+};
+
+struct operator
+{
+    const char *str;
+    size_t len;
+    int precedence;  // index of the precedence group, 0 binds tightest, -1 if not binary
+    int associativity;
+    int flags;
+};
+
 enum
 {
     NUMBER_TYPE_NORMAL,
@@ -105,56 +154,252 @@ struct token
         int type;
     } num;
 
+    // KEYWORD_* id for keyword tokens, KEYWORD_NONE for everything else.
+    int keyword;
+
+    // OPERATOR_* id for operator tokens, OPERATOR_NONE for everything else.
+    int op;
+
     // True if there is a space between this token and the next token.
     bool whitespace;
 
-    // Points to the first character in the bracket.
-    // If not between brackets, this is NULL.
-    const char *between_brackets;
+    // Offset of the first character inside the outermost bracket this token is in,
+    // 0 if not between brackets. compile_process_bracket_text gives the text.
+    uint32_t between_brackets;
+};
+
+VECTOR_DEFINE_TYPED(token, struct token)
+
+/**
+ * A matched pair of parentheses, as offsets into the source
+ */
+struct bracket_span
+{
+    uint32_t start;  // offset of the (
+    uint32_t end;    // offset of the matching ), the end of the input if it was never closed
+};
+
+/**
+ * Compact structure of arrays copy of a token stream, see token_store.c
+ */
+struct token_store
+{
+    int count;
+    int capacity;
+    uint8_t *kinds;
+    uint32_t *offsets;
+    uint32_t *payloads;
+    uint32_t *brackets;  // between_brackets of each token
+
+    // Spellings referenced by payloads, and a hash from spelling pointer to index
+    const char **atoms;
+    int total_atoms;
+    uint32_t *atom_slots;
+    int total_atom_slots;
+
+    // Numbers that don't fit in a payload
+    unsigned long long *wide_values;
+    int total_wide_values;
+    int wide_values_capacity;
+
+    // The text the offsets point into, used to work out line and column
+    const char *source;
+    size_t size;
+    const char *filename;
+    uint32_t *line_starts;  // built on first use
+    int total_lines;
+};
+
+#define TOKEN_STREAM_DEFAULT_CAPACITY 4096
+
+/**
+ * Tokens lexed on demand into a ring buffer, see token_stream.c
+ */
+struct token_stream
+{
+    struct lex_process *lex_process;
+    // The compiler's position as the lexer left it, the parser's own stays in the compiler
+    struct pos lexer_pos;
+
+    // Ring of tokens and where each starts, capacity is a power of two
+    struct token *tokens;
+    uint32_t *offsets;
+    int capacity;
+
+    // Absolute token indexes: the oldest one still held, one past the newest, and the next to hand out
+    int head;
+    int tail;
+    int cursor;
+
+    struct vector *saves;  // cursors pinned by token_stream_save, int
+    int total_tokens;
+
+    // Where tokens come from when the lexer runs on its own thread, NULL when the stream drives it
+    struct token_queue *queue;
+
+    // Tokens get their position from their offset, the way the token store gives them one
+    struct token_store *positions;
+};
+
+#define TOKEN_QUEUE_BATCH_SIZE 1024
+#define TOKEN_QUEUE_TOTAL_BATCHES 8
+#define TOKEN_QUEUE_CACHE_LINE 64
+
+struct token_batch
+{
+    int count;
+    struct token tokens[TOKEN_QUEUE_BATCH_SIZE];
+    uint32_t offsets[TOKEN_QUEUE_BATCH_SIZE];
+};
+
+/**
+ * Hands tokens from a lexer thread to a parser thread, see token_queue.c
+ */
+struct token_queue
+{
+    struct token_batch batches[TOKEN_QUEUE_TOTAL_BATCHES];
+
+    // Batches published by the producer and handed back by the consumer. Each
+    // is written by one side only, and they sit on their own cache lines.
+    _Alignas(TOKEN_QUEUE_CACHE_LINE) atomic_uint published;
+    _Alignas(TOKEN_QUEUE_CACHE_LINE) atomic_uint consumed;
+
+    _Alignas(TOKEN_QUEUE_CACHE_LINE) atomic_bool closed;  // no more batches will be published
+    atomic_bool cancelled;                                 // the consumer has stopped reading
+    bool failed;                                           // the producer gave up on an error, set before closed
+
+    // Producer side only
+    struct token_batch *writing;
+
+    // Consumer side only
+    _Alignas(TOKEN_QUEUE_CACHE_LINE) struct token_batch *reading;
+    int read_index;
 };
 
 struct lex_process;
+struct hash_sha256;
+struct intern_pool;
 typedef char (*LEX_PROCESS_NEXT_CHAR)(struct lex_process *process);
 typedef char (*LEX_PROCESS_PEEK_CHAR)(struct lex_process *process);
 typedef void (*LEX_PROCESS_PUSH_CHAR)(struct lex_process *process, char c);
+typedef const char *(*LEX_PROCESS_INPUT_SPAN)(struct lex_process *process, size_t *len_out);
+typedef void (*LEX_PROCESS_SKIP_CHARS)(struct lex_process *process, size_t amount);
 
 struct lex_process_functions
 {
     LEX_PROCESS_NEXT_CHAR next_char;
     LEX_PROCESS_PEEK_CHAR peek_char;
     LEX_PROCESS_PUSH_CHAR push_char;
+
+    // Optional. Inputs that sit in one block of memory can hand the rest of it
+    // to the lexer, which then scans whole runs of characters at a time and
+    // steps over them with skip_chars.
+    LEX_PROCESS_INPUT_SPAN input_span;
+    LEX_PROCESS_SKIP_CHARS skip_chars;
+};
+
+enum
+{
+    // Every token goes onto tokens and the token store stays empty. For a
+    // consumer that takes tokens off the vector as they come, see token_stream.c.
+    LEX_PROCESS_FLAG_NO_TOKEN_STORE = 1 << 0,
+    // No bracket spans and no between_brackets, a chunk of a bigger input being
+    // lexed on its own. lex_parallel redoes them once the chunks are joined up.
+    LEX_PROCESS_FLAG_NO_BRACKETS = 1 << 1,
 };
 
 struct lex_process
 {
     struct pos pos;
-    struct vector *tokens;
+    struct vector *tokens;  // just the newest token when the token store is kept
     struct compile_process *compiler;
 
     int current_expression_count;
-    struct buffer *parentheses_buffer;
+    struct vector *brackets;       // struct bracket_span for every (, ordered by start
+    struct vector *open_brackets;  // indexes into brackets of the ones not closed yet
     struct lex_process_functions *function;
 
+    // Scratch space for the spelling of the token being read, reused for every token.
+    struct buffer *buffer;
+
+    // Characters consumed so far, and where the token being read started
+    uint32_t offset;
+    uint32_t token_offset;
+
+    // Every token lexed, in compact form
+    struct token_store *token_store;
+    uint32_t last_token_offset;  // where the newest token in tokens starts
+
+    int flags;
+    bool finished;  // the whole input has been read
+
+    // The token being built by token_create, copied into tokens by lex.
+    struct token temp_token;
+
     // Private data that the lexer does not understand but the user does.
     void *private;
 };
 
+/**
+ * A change to the text a lex_process has lexed, see lex_relex
+ */
+struct lex_edit
+{
+    uint32_t offset;          // where the change starts
+    uint32_t total_removed;   // characters of the old text that went
+    uint32_t total_inserted;  // characters of new text in their place
+
+    // Filled in by lex_relex: the first token that changed, and how many tokens
+    // from there were replaced by how many new ones
+    int first_token;
+    int total_old_tokens;
+    int total_new_tokens;
+};
+
 enum
 {
     COMPILER_FILE_COMPILE_SUCCESS = 0,
     COMPILER_FILE_COMPILE_FAILED = 1,
 };
 
+enum
+{
+    // Lex as the parser asks for tokens rather than all up front, see token_stream.c
+    COMPILE_PROCESS_FLAG_STREAM_TOKENS = 1 << 0,
+    // Lex on a thread of its own while the parser works through what it has
+    // produced so far, see compile_lexer_thread in compiler.c
+    COMPILE_PROCESS_FLAG_PIPELINE = 1 << 1,
+    // Work that is thrown away and redone if it fails, compiler_error says nothing
+    COMPILE_PROCESS_FLAG_SPECULATIVE = 1 << 2,
+};
+
 struct scope
 {
     int flags;
 
     struct vector *entities;  // Void pointers to variables, functions, etc.
     size_t size; // Total number to bytes. Aligned to 16 bytes.
+    int bindings_start;  // where this scope's names begin in the process's scope.bindings
 
     struct scope *parent;  // NULL if no parent.
 };
 
+// A name bound in some scope, see scope_bind
+struct scope_binding
+{
+    const char *name;  // interned
+    void *entity;
+    struct scope *scope;
+    int shadowed;  // index of the binding of the same name this one hides, -1 if none
+};
+
+// Open addressing on the intern hash of the name
+struct scope_slot
+{
+    const char *name;
+    int binding;  // innermost live binding of name, -1 if none
+};
+
 enum
 {
     SYMBOL_TYPE_NODE,
@@ -169,6 +414,71 @@ struct symbol
     void *data;
 };
 
+// Open addressing on the hash of the interned name, at most half full
+struct symbol_table
+{
+    struct symbol **slots;
+    int total_slots;
+    int total_symbols;
+};
+
+struct compile_stats
+{
+    // Bytes each phase allocated. The lexer's token store, bracket spans, interned
+    // spellings and arena use, then the parser's arena use, AST pools and stacks.
+    size_t lex_bytes;
+    size_t parse_bytes;
+
+    // Total allocations made from the arena
+    size_t arena_allocations;
+
+    // Heap and arena allocations made while parsing, the AST pools and the parser's
+    // stacks included. Histories are values, so this only grows as the pools double.
+    size_t parse_allocations;
+
+    // Bytes held by the AST pools
+    size_t ast_bytes;
+
+    // The tokens came out of the token cache rather than the lexer
+    bool token_cache_hit;
+
+    // The output was copied out of the compile cache, nothing was lexed or parsed
+    bool compile_cache_hit;
+};
+
+// Every node of a translation unit, in the order they were created
+struct ast
+{
+    struct node *nodes;
+    uint32_t *offsets;  // where the token each node was made at starts in the source
+    struct node_binded *binded;
+    uint32_t count;
+    uint32_t capacity;
+    size_t total_allocations;  // reallocs made growing the pools
+};
+
+// Flags handed down through the parser. Passed by value, it never touches the heap.
+struct history
+{
+    int flags;
+};
+
+// An entry on the parser's expression stack
+struct parser_exp_frame
+{
+    int op;  // OPERATOR_* waiting for its right operand, or OPERATOR_NONE for an open parenthesis
+};
+
+// Tunables for a single compile, zero means the default
+struct compile_options
+{
+    int max_expression_depth;
+    int lex_threads;  // lex with lex_parallel when more than one
+    const char *token_cache_dir;  // where token_cache keeps lexed tokens, NULL to always lex
+    const char *compile_cache_dir;  // where compile_cache keeps outputs, NULL to always compile
+    size_t compile_cache_max_size;  // bytes the compile cache may hold, 0 for COMPILE_CACHE_DEFAULT_MAX_SIZE
+};
+
 struct compile_process
 {
     int flags;
@@ -176,13 +486,22 @@ struct compile_process
     struct pos pos;
     struct compiler_process_input_file
     {
-        FILE *fp;
         const char *abs_path;
+
+        // The whole source file as one contiguous block. Memory mapped when
+        // the input is a regular file, read into memory otherwise (e.g. pipes).
+        const char *data;
+        size_t size;
+        size_t offset;  // index of the next character to read from data
+        bool mapped;
     } cfile;
 
-    struct vector *tokens;
+    struct token_store *token_store;  // every token of the input, what the parser reads
+    struct token_stream *token_stream;  // set instead of token_store when COMPILE_PROCESS_FLAG_STREAM_TOKENS is
+    struct vector *brackets;  // struct bracket_span, ordered by start
+    struct ast ast;
     struct vector *node_vec;  // tempary vector for nodes used to construct the node tree
-    struct vector *node_tree_vec;  // the actual node tree
+    struct vector *node_tree_vec;  // the actual node tree, indices of the root nodes
 
     FILE *ofile;
 
@@ -190,15 +509,60 @@ struct compile_process
     {
         struct scope *root;
         struct scope *current;
+
+        // Every name bound in the open scopes, innermost last. Doubles as the
+        // undo log, scope_finish drops the closing scope's tail and restores
+        // what those bindings shadowed.
+        struct vector *bindings;
+        struct scope_slot *slots;
+        int total_slots;
+        int total_names;
     } scope;
 
     struct
     {
-        struct vector *table;  // current active symbol table
-        struct vector *tables;
+        struct symbol_table *table;  // current active symbol table
+        struct vector *tables;       // the tables it shadows, struct symbol_table *
     } symbols;
+
+    // compile_file points compiler_error here so a bad input fails its own
+    // compile rather than exiting the whole process.
+    jmp_buf *error_recovery;
+
+    struct
+    {
+        struct token *last_token;  // last token returned by token_next
+        uint32_t last_token_offset;
+
+        // Without a token stream the parser reads token_store, expanding a
+        // token at a time into these. A token stays valid until the next call
+        // to token_next or token_peek_next that returned it.
+        int token_index;   // next token in token_store
+        int peeked_index;  // which token peeked_token holds, -1 for none
+        struct token next_token;
+        struct token peeked_token;
+
+        int random_type_index;     // suffix for the names of anonymous structs and unions
+
+        // Operators and open parentheses still waiting for their right operand,
+        // see parse_exp_operators. Lives on the heap so long expressions never
+        // deepen the C stack.
+        struct vector *exp_stack;
+        int max_expression_depth;
+    } parser;
+
+    // Everything the front end allocates for this translation unit, freed in one go by compile_process_free
+    struct arena *arena;
+    struct arena *lex_arena;  // what a pipelined lexer allocates, it can't share arena with the parser
+    struct intern_pool *intern_pool;  // every spelling interned for this translation unit, shared with its lexer threads
+
+    struct compile_lexer_thread *lexer_thread;  // set while a pipelined lexer is running
+    struct compile_stats stats;
 };
 
+// How many operators and parentheses an expression may leave open at once
+#define PARSER_DEFAULT_MAX_EXPRESSION_DEPTH 1000000
+
 enum
 {
     PARSE_SUCCESS,
@@ -245,31 +609,35 @@ enum
     NODE_FLAG_INSIDE_EXPRESSION = 1 << 0,
 };
 
-struct node
-{
-    int type;
-    int flags;
+// Nodes refer to each other by index into compile_process.ast, index 0 is never a node
+#define NODE_NONE 0
 
-    struct pos pos;
+// The node stack and node_tree_vec hold node indices
+VECTOR_DEFINE_TYPED(node, uint32_t)
 
-    struct node_binded
-    {
-        struct node *owner;    // pointer to the body node
-        struct node *function; // pointer to the function this node is in
-    } binded;
+/*
+ * Sixteen bytes, so the tree walks stream through memory. Fields only a few
+ * passes need live in side tables next to the nodes, see struct ast.
+ */
+struct node
+{
+    uint8_t type;
+    uint8_t flags;
+    uint16_t op;  // OPERATOR_* id of a NODE_TYPE_EXPRESSION
 
     union
     {
         struct exp
         {
-            struct node *left;
-            struct node *right;
-            const char *op;
+            uint32_t left;
+            uint32_t right;
         } exp;
-    };
 
-    union
-    {
+        struct parenthesis
+        {
+            uint32_t exp;
+        } parenthesis;
+
         char cval;
         const char *sval;
         unsigned int inum;
@@ -278,6 +646,12 @@ struct node
     };
 };
 
+struct node_binded
+{
+    uint32_t owner;     // index of the body node
+    uint32_t function;  // index of the function this node is in
+};
+
 enum
 {
     DATATYPE_FLAG_IS_SIGNED = 1 << 0,
@@ -318,8 +692,8 @@ struct datatype
 
     union 
     {
-        struct node *struct_node;
-        struct node *union_node;
+        uint32_t struct_node;
+        uint32_t union_node;
     };
 };
 
@@ -340,96 +714,383 @@ enum
 };
 
 // cpprocess.c
+// Source offsets, bracket spans and node positions are all 32-bit
+#define COMPILE_PROCESS_MAX_INPUT_SIZE UINT32_MAX
 struct compile_process *compile_process_create(const char *filename, const char *out_filename, int flags);
+void compile_process_free(struct compile_process *process);
 char compile_process_next_char(struct lex_process *lex_process);
 char compile_process_peek_char(struct lex_process *lex_process);
 void compile_process_push_char(struct lex_process *lex_process, char c);
+const char *compile_process_input_span(struct lex_process *lex_process, size_t *len_out);
+void compile_process_skip_chars(struct lex_process *lex_process, size_t amount);
+/**
+ * Moves pos past the len characters at data, the same as reading them one at a time would
+ */
+void pos_advance(struct pos *pos, const char *data, size_t len);
+struct bracket_span *compile_process_bracket_at(struct compile_process *process, uint32_t start);
+/**
+ * Returns the text between the brackets the token is in, without copying it.
+ * NULL if the token is not between brackets.
+ */
+const char *compile_process_bracket_text(struct compile_process *process, struct token *token, size_t *len_out);
 
 // compiler.c
+// Generous for real code, the token store is sized from the input with this up front
+#define COMPILER_BYTES_PER_TOKEN_ESTIMATE 4
+extern struct lex_process_functions compiler_lex_process_functions;
 void compiler_error(struct compile_process *compiler, const char *message, ...);
 void compiler_warning(struct compile_process *compiler, const char *message, ...);
 int compile_file(const char *filename, const char *out_filename, int flags);
+int compile_file_with_stats(const char *filename, const char *out_filename, int flags, struct compile_options *options, struct compile_stats *stats);
 
 // lex_process.c
 struct lex_process *lex_process_create(struct compile_process *compiler, struct lex_process_functions *functions, void *private);
 void lex_process_free(struct lex_process *process);
 void *lex_process_private(struct lex_process *process);
 struct vector *lex_process_tokens(struct lex_process *process);
+bool lex_process_keeps_token_store(struct lex_process *process);
 
 // lexer.c
-int lex(struct lex_process *process);
-struct token *token_create(struct token *_token);
-const char *read_number_str();
-unsigned long long read_number();
-struct token *token_make_number_for_value(unsigned long number);
-struct token *token_make_number();
-struct token *read_next_token();
-const char *read_op();
-bool lex_is_in_expression();
+int lex(struct lex_process *lex_process);
+
+void lex_begin(struct lex_process *lex_process);
+/**
+ * Reads one more token onto the end of the token store, or lex_process->tokens without
+ * one. False once the input is used up.
+ */
+bool lex_step(struct lex_process *lex_process);
+/**
+ * Hands out the oldest token the lexer won't change any more, reading more of the
+ * input as needed. Only for a lexer that nothing else takes tokens from. False at the end.
+ */
+bool lex_next_token(struct lex_process *lex_process, struct token *token_out, uint32_t *offset_out);
+struct token *token_create(struct lex_process *lex_process, struct token *_token);
+const char *read_number_str(struct lex_process *lex_process);
+unsigned long long read_number(struct lex_process *lex_process);
+struct token *token_make_number_for_value(struct lex_process *lex_process, unsigned long number);
+struct token *token_make_number(struct lex_process *lex_process);
+struct token *read_next_token(struct lex_process *lex_process);
+int read_op(struct lex_process *lex_process);
+bool lex_is_in_expression(struct lex_process *lex_process);
+/**
+ * Does the bracket bookkeeping for the token at index in lex_process's store, lexed
+ * with LEX_PROCESS_FLAG_NO_BRACKETS, as if lex_process had lexed it there. Sets the
+ * token's between_brackets.
+ */
+void lex_replay_brackets(struct lex_process *lex_process, int index);
 bool keyword_is_datatype(const char *str);
-struct token *token_read_special_token();
+struct token *token_read_special_token(struct lex_process *lex_process);
 bool is_keyword(const char *str);
-struct token *token_make_one_line_comment();
-struct token *token_make_multiline_comment();
-struct token *handle_comment();
-struct token *token_make_quote();
+struct token *token_make_one_line_comment(struct lex_process *lex_process);
+struct token *token_make_multiline_comment(struct lex_process *lex_process);
+struct token *handle_comment(struct lex_process *lex_process);
+struct token *token_make_quote(struct lex_process *lex_process);
 char lex_get_escaped_char(char c);
-void lex_pop_token();
-struct token *token_make_special_number_hexadecimal();
-void lex_validate_binary_string(char *str);
-struct token *token_make_special_number_binary();
-struct token *token_make_special_number();
+void lex_pop_token(struct lex_process *lex_process);
+struct token *token_make_special_number_hexadecimal(struct lex_process *lex_process);
+void lex_validate_binary_string(struct lex_process *lex_process, char *str);
+struct token *token_make_special_number_binary(struct lex_process *lex_process);
+struct token *token_make_special_number(struct lex_process *lex_process);
 struct lex_process *token_build_for_string(struct compile_process *compiler, const char *str);
 
+// lex_parallel.c
+/**
+ * Same tokens as lex, but a large input is split into chunks of about chunk_size
+ * bytes that are lexed on total_threads threads. A chunk_size of 0 picks one from
+ * the input size and the thread count.
+ */
+int lex_parallel(struct lex_process *lex_process, int total_threads, size_t chunk_size);
+
+// lex_incremental.c
+/**
+ * Brings the tokens of a finished lex up to date with an edit, lexing again only
+ * the lines the edit could have changed. source and size are the whole text with
+ * the edit made, it must outlive the tokens. The tokens come out the same as lex
+ * would have made them from source, brackets included.
+ */
+int lex_relex(struct lex_process *lex_process, const char *source, size_t size, struct lex_edit *edit);
+
+// token_cache.c
+// Keys are made like the compile cache's, the token cache trusts them as far
+#define TOKEN_CACHE_KEY_SIZE COMPILE_CACHE_KEY_SIZE
+/**
+ * Writes the key for the tokens of process's input, lexed by this very compiler binary,
+ * to key. False if the binary can't be told apart from another build.
+ */
+bool token_cache_key(struct compile_process *process, char *key);
+/**
+ * Fills a fresh lex_process with the tokens cached in directory under key, from
+ * token_cache_key, as if it had lexed them. False if there are none, or they don't
+ * match the input and lexer.
+ */
+bool token_cache_load(struct lex_process *lex_process, const char *directory, const char *key);
+/**
+ * Saves the tokens of a finished lex to directory for token_cache_load. 0 on success.
+ */
+int token_cache_save(struct lex_process *lex_process, const char *directory, const char *key);
+
+// compile_cache.c
+#define COMPILE_CACHE_DEFAULT_MAX_SIZE (1024ull * 1024 * 1024)
+// A key is a SHA-256 in hex
+#define COMPILE_CACHE_KEY_SIZE (64 + 1)
+/**
+ * Writes the key for the output of compiling process's input with flags and options,
+ * by this very compiler binary, to key. False if the binary can't be told apart from
+ * another build, nothing should be cached then.
+ */
+bool compile_cache_key(struct compile_process *process, int flags, struct compile_options *options, char *key);
+/**
+ * Starts sha on a key with the identity of this compiler binary. False if it can't be
+ * told apart from another build.
+ */
+bool compile_cache_begin_key(struct hash_sha256 *sha);
+/**
+ * Adds process's input to sha and writes the finished key to key
+ */
+void compile_cache_end_key(struct hash_sha256 *sha, struct compile_process *process, char *key);
+/**
+ * Writes the output cached in directory under key to out. False if there is none,
+ * out is left as it was then.
+ */
+bool compile_cache_fetch(const char *directory, const char *key, FILE *out);
+/**
+ * Copies the output in out_filename into directory under key, then evicts the least
+ * recently used outputs until the directory holds no more than max_size bytes. 0 on success.
+ */
+int compile_cache_store(const char *directory, const char *key, const char *out_filename, size_t max_size);
+
+// keyword.c
+int keyword_lookup(const char *str, size_t len);
+int keyword_lookup_hashed(const char *str, size_t len, uint32_t hash);
+bool keyword_has_flag(int keyword, int flag);
+
+// intern.c
+struct intern_pool *intern_pool_create();
+void intern_pool_free(struct intern_pool *pool);
+/**
+ * Bytes held by the pool's atoms and buckets
+ */
+size_t intern_pool_memory_usage(struct intern_pool *pool);
+const char *intern_string(struct intern_pool *pool, const char *str, size_t len);
+const char *intern_string_hashed(struct intern_pool *pool, const char *str, size_t len, uint32_t hash);
+/**
+ * The atom every pool gives for a keyword or operator, NULL if str is neither
+ */
+const char *intern_lexicon(const char *str, size_t len);
+uint32_t intern_hash(const char *interned);
+size_t intern_length(const char *interned);
+bool intern_equals(const char *interned, const char *str);
+
 // token.c
 bool token_is_keyword(struct token *token, const char *keyword);
+bool token_is_keyword_id(struct token *token, int keyword);
 bool token_is_symbol(struct token *token, char symbol);
 bool token_is_newline_or_comment(struct token *token);
 bool token_is_operator(struct token *token, const char *op);
+bool token_is_operator_id(struct token *token, int op);
 bool token_is_primitive_keyword(struct token *token);
 
+// token_store.c
+struct token_store *token_store_create(const char *source, size_t size, const char *filename);
+void token_store_free(struct token_store *store);
+void token_store_reserve(struct token_store *store, int total_tokens);
+void token_store_push(struct token_store *store, struct token *token, uint32_t offset);
+void token_store_pop(struct token_store *store);
+void token_store_set_whitespace(struct token_store *store, int index);
+/**
+ * Replaces total_removed tokens from index on with all of other's tokens, and moves
+ * the tokens after them offset_delta characters along.
+ */
+void token_store_replace(struct token_store *store, int index, int total_removed, struct token_store *other, int32_t offset_delta);
+/**
+ * Points the store at a new copy of the text its offsets are into
+ */
+void token_store_set_source(struct token_store *store, const char *source, size_t size);
+int token_store_count(struct token_store *store);
+int token_store_type(struct token_store *store, int index);
+uint32_t token_store_offset(struct token_store *store, int index);
+/**
+ * Index into atoms of the token's spelling, -1 for a token that has none
+ */
+int token_store_atom(struct token_store *store, int index);
+/**
+ * Whether every payload is in range of the store's atoms and wide values, for a
+ * store whose arrays came from somewhere other than the lexer
+ */
+bool token_store_payloads_valid(struct token_store *store);
+bool token_store_is_symbol(struct token_store *store, int index, char c);
+bool token_store_is_operator(struct token_store *store, int index, int op);
+uint32_t token_store_between_brackets(struct token_store *store, int index);
+void token_store_set_between_brackets(struct token_store *store, int index, uint32_t between_brackets);
+/**
+ * Returns the index of the first token at or after index that isn't a newline,
+ * comment or line continuation. Returns the token count if there is none.
+ */
+int token_store_skip_newlines_and_comments(struct token_store *store, int index);
+/**
+ * Line and column of the first character of the token, worked out from its offset
+ */
+struct pos token_store_pos(struct token_store *store, int index);
+/**
+ * Line and column of a source offset. Works whether or not the store holds any tokens.
+ */
+struct pos token_store_pos_at_offset(struct token_store *store, uint32_t offset);
+/**
+ * Expands the compact token at index back into a full token
+ */
+void token_store_token(struct token_store *store, int index, struct token *token_out);
+size_t token_store_memory_usage(struct token_store *store);
+
+// token_stream.c
+struct token_stream *token_stream_create(struct lex_process *lex_process, int capacity);
+struct token_stream *token_stream_create_for_queue(struct token_queue *queue, struct token_store *positions, int capacity);
+void token_stream_free(struct token_stream *stream);
+/**
+ * The next token without moving past it, lexing more of the input if need be. NULL at the end.
+ */
+struct token *token_stream_peek(struct token_stream *stream);
+struct token *token_stream_next(struct token_stream *stream);
+/**
+ * Source offset of the token token_stream_next last returned
+ */
+uint32_t token_stream_last_offset(struct token_stream *stream);
+void token_stream_skip_newlines_and_comments(struct token_stream *stream);
+/**
+ * Like vector_save and vector_restore, the tokens from the saved cursor on are kept until the save is restored or purged
+ */
+void token_stream_save(struct token_stream *stream);
+void token_stream_restore(struct token_stream *stream);
+void token_stream_save_purge(struct token_stream *stream);
+size_t token_stream_memory_usage(struct token_stream *stream);
+
+// token_queue.c
+struct token_queue *token_queue_create();
+void token_queue_free(struct token_queue *queue);
+/**
+ * Producer side. Blocks while every batch is full. False once the consumer has cancelled.
+ */
+bool token_queue_push(struct token_queue *queue, struct token *token, uint32_t offset);
+/**
+ * Producer side. Publishes what is left and tells the consumer nothing more is coming.
+ */
+void token_queue_close(struct token_queue *queue, bool failed);
+/**
+ * Consumer side. Blocks until a token is there. False once the queue is closed and empty.
+ */
+bool token_queue_pop(struct token_queue *queue, struct token *token_out, uint32_t *offset_out);
+void token_queue_cancel(struct token_queue *queue);
+bool token_queue_failed(struct token_queue *queue);
+
 // parser.c
-struct history *history_begin(int flags);
-struct history *history_down(struct history *history, int flags);
-void parse_single_token_to_node();
-void parse_expressionable_for_op(struct history *history, const char *op);
-void parse_exp_normal(struct history *history);
-int parse_exp(struct history *history);
-int parse_expressionable_single(struct history *history);
-void parse_expressionable(struct history *history);
-int parse_next();
+struct history history_begin(int flags);
+void parse_single_token_to_node(struct compile_process *process);
+int parse_exp_normal(struct compile_process *process, struct history *history);
+int parse_exp_parentheses(struct compile_process *process, struct history *history);
+int parse_exp(struct compile_process *process, struct history *history);
+int parse_expressionable_single(struct compile_process *process, struct history *history);
+void parse_expressionable(struct compile_process *process, struct history *history);
+int parse_next(struct compile_process *process);
 int parse(struct compile_process *process);
-void parser_datatype_adjust_size_for_secondary(struct datatype *datatype, struct token *secondary_datatype_token);
-void parser_ignore_int(struct datatype *dtype);
+void parser_datatype_adjust_size_for_secondary(struct compile_process *process, struct datatype *datatype, struct token *secondary_datatype_token);
+void parser_ignore_int(struct compile_process *process, struct datatype *dtype);
 
 // node.c
-void node_set_vector(struct vector *vec, struct vector *root);
-void node_push(struct node *node);
-struct node *node_peek_or_null();
-struct node *node_peek();
-struct node *node_pop();
-struct node *node_create(struct node *_node);
-void make_exp_node(struct node *left_node, struct node *right_node, const char *op);
+void node_push(struct compile_process *process, uint32_t node);
+/**
+ * The node at index. The pointer is good until the next node_create
+ */
+struct node *node_at(struct compile_process *process, uint32_t node);
+struct pos node_pos(struct compile_process *process, uint32_t node);
+struct node_binded *node_binded(struct compile_process *process, uint32_t node);
+struct node *node_peek_or_null(struct compile_process *process);
+struct node *node_peek(struct compile_process *process);
+uint32_t node_peek_index(struct compile_process *process);
+uint32_t node_pop(struct compile_process *process);
+uint32_t node_create(struct compile_process *process, struct node *_node);
+void make_exp_node(struct compile_process *process, uint32_t left_node, uint32_t right_node, int op);
 bool node_is_expressionable(struct node *node);
-struct node *node_peek_expressionable_or_null();
+void ast_free(struct ast *ast);
+size_t ast_memory_usage(struct ast *ast);
+struct node *node_peek_expressionable_or_null(struct compile_process *process);
 
 // expressionable.c
-#define TOTAL_OPERATOR_GROUPS 14
-#define MAX_OPERATOR_IN_GROUP 12
 enum
 {
     ASSOCIATIVITY_LEFT_TO_RIGHT,
     ASSOCIATIVITY_RIGHT_TO_LEFT,
 };
-struct expressionable_op_precedence_group
+extern const struct operator operators[OPERATOR_TOTAL];
+int operator_lookup(const char *str, size_t len);
+bool operator_has_flag(int op, int flag);
+/**
+ * Returns the interned spelling of the operator
+ */
+const char *operator_atom(int op);
+
+// batch.c
+struct batch_file
 {
-    char *operators[MAX_OPERATOR_IN_GROUP];
-    int associtivity;
+    const char *filename;
+    char *out_filename;
+    size_t size;      // size of the input in bytes, bigger files are started first
+    int result;       // COMPILER_FILE_COMPILE_SUCCESS or COMPILER_FILE_COMPILE_FAILED
+    double seconds;   // wall clock time spent compiling this file
+    struct compile_stats stats;
 };
 
+// The input that writes an output, both owned by its struct batch_file
+struct batch_output
+{
+    const char *out_filename;
+    const char *filename;
+};
+
+struct batch
+{
+    struct vector *files;  // vector of struct batch_file
+    // Open addressing on the hash of every out_filename, at most half full. Two
+    // inputs writing the same output at once would corrupt it, so there's one each.
+    struct batch_output *outputs;
+    int total_output_slots;
+    int total_threads;
+    int flags;
+    struct compile_options options;
+
+    int total_failed;
+    double seconds;
+};
+
+struct batch *batch_create(int total_threads, int flags);
+void batch_free(struct batch *batch);
+/**
+ * Adds filename to the batch. -1 if it would be compiled to the same output as a file
+ * already in it, it isn't added then.
+ */
+int batch_add_file(struct batch *batch, const char *filename);
+/**
+ * Adds every file listed in filename. -1 if it can't be read or a file in it can't be added.
+ */
+int batch_add_response_file(struct batch *batch, const char *filename);
+int batch_compile(struct batch *batch);
+void batch_print_summary(struct batch *batch, FILE *out);
+
 // datatype.c
 bool datatype_is_struct_or_union_for_name(const char *name);
 
+// symresolver.c
+void sysrosolver_init(struct compile_process *process);
+void symresolver_new_table(struct compile_process *process);
+void symresolver_end_table(struct compile_process *process);
+void symresolver_free(struct compile_process *process);
+/**
+ * name must be interned
+ */
+struct symbol *symresolver_get_symbol(struct compile_process *process, const char *name);
+struct symbol *symresolver_get_symbol_for_native_function(struct compile_process *process, const char *name);
+struct symbol *symresolver_register_symbol(struct compile_process *process, const char *name, int type, void *data);
+uint32_t symresolver_node(struct symbol *symbol);
+void symresolver_build_for_node(struct compile_process *process, struct node *node);
+
 // scope.c
 struct scope *scope_alloc();
 void scope_dealloc(struct scope *scope);
@@ -443,6 +1104,16 @@ void *scope_last_entity_at_scope(struct scope *scope);
 void *scope_last_entity_from_scope_stop_at(struct scope *scope, struct scope *stop_scope);
 void *scope_last_entity_stop_at(struct compile_process *process, struct scope *stop_scope);
 void scope_push(struct compile_process *process, void *entity, size_t entity_size);
+/**
+ * Pushes entity and makes it what name refers to until the current scope finishes
+ */
+void scope_bind(struct compile_process *process, const char *name, void *entity, size_t entity_size);
+/**
+ * The entity name refers to in the current scope, NULL if it is not bound.
+ * name must be interned.
+ */
+void *scope_lookup(struct compile_process *process, const char *name);
+struct scope_binding *scope_lookup_binding(struct compile_process *process, const char *name);
 void scope_finish(struct compile_process *process);
 struct scope *scope_current(struct compile_process *process);
 struct scope *scope_root(struct compile_process *process);
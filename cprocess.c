@@ -1,20 +1,99 @@
+#define _FILE_OFFSET_BITS 64
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "compiler.h"
 #include "helpers/vector.h"
+#include "helpers/arena.h"
+
+#define COMPILE_PROCESS_READ_CHUNK_SIZE (64 * 1024)
+
+// Used when the input can't be mapped, e.g. it is a pipe or a character device.
+static bool compile_process_read_input(struct compile_process *process, FILE *file)
+{
+    size_t size = 0;
+    size_t capacity = COMPILE_PROCESS_READ_CHUNK_SIZE;
+    char *data = malloc(capacity);
+    if (!data)
+    {
+        return false;
+    }
+
+    size_t read_amount = fread(data, 1, capacity, file);
+    while (read_amount)
+    {
+        size += read_amount;
+        if (size == capacity)
+        {
+            capacity *= 2;
+            char *new_data = realloc(data, capacity);
+            if (!new_data)
+            {
+                free(data);
+                return false;
+            }
+            data = new_data;
+        }
+        read_amount = fread(data + size, 1, capacity - size, file);
+    }
+
+    process->cfile.data = data;
+    process->cfile.size = size;
+    process->cfile.mapped = false;
+    return true;
+}
+
+static void compile_process_free_input(struct compile_process *process)
+{
+    if (process->cfile.mapped)
+    {
+        munmap((void *)process->cfile.data, process->cfile.size);
+    }
+    else
+    {
+        free((void *)process->cfile.data);
+    }
+}
+
+static bool compile_process_map_input(struct compile_process *process, FILE *file)
+{
+    struct stat st;
+    int fd = fileno(file);
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        // An empty regular file can't be mapped, reading it is just as cheap.
+        return compile_process_read_input(process, file);
+    }
+
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        return compile_process_read_input(process, file);
+    }
+
+    // The lexer walks the file front to back exactly once.
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    process->cfile.data = data;
+    process->cfile.size = (size_t)st.st_size;
+    process->cfile.mapped = true;
+    return true;
+}
 
 struct compile_process* compile_process_create(const char *filename, const char *out_filename, int flags)
 {
     FILE* file = fopen(filename, "r");
     if (!file)
     {
-        fclose(file);
         return NULL;
     }
 
     FILE* out_file = NULL;
-    if (!out_filename)
+    if (out_filename)
     {
         out_file = fopen(out_filename, "w");
         if (!out_file)
@@ -25,21 +104,89 @@ struct compile_process* compile_process_create(const char *filename, const char
     }
 
     struct compile_process* process = calloc(1, sizeof(struct compile_process));
-    process->node_vec = vector_create(sizeof(struct node*));
-    process->node_tree_vec = vector_create(sizeof(struct node*));
+    if (!compile_process_map_input(process, file))
+    {
+        fclose(file);
+        if (out_file)
+        {
+            fclose(out_file);
+        }
+        free(process);
+        return NULL;
+    }
+
+    // The whole input now lives in memory, we have no further use for the stream.
+    fclose(file);
+
+    if (process->cfile.size > COMPILE_PROCESS_MAX_INPUT_SIZE)
+    {
+        fprintf(stderr, "%s is %zu bytes, inputs of more than 4 GiB are not supported\n", filename, process->cfile.size);
+        compile_process_free_input(process);
+        if (out_file)
+        {
+            fclose(out_file);
+        }
+        free(process);
+        return NULL;
+    }
+
+    process->node_vec = vector_create(sizeof(uint32_t));
+    process->node_tree_vec = vector_create(sizeof(uint32_t));
+    process->arena = arena_create(ARENA_DEFAULT_CHUNK_SIZE);
+    process->intern_pool = intern_pool_create();
+    process->parser.exp_stack = vector_create(sizeof(struct parser_exp_frame));
+    process->parser.max_expression_depth = PARSER_DEFAULT_MAX_EXPRESSION_DEPTH;
 
     process->flags = flags;
-    process->cfile.fp = file;
     process->ofile = out_file;
+    process->cfile.abs_path = filename;
+    process->pos.filename = filename;
+    process->pos.line = 1;
+    process->pos.col = 1;
 
     return process;
 }
 
+void compile_process_free(struct compile_process *process)
+{
+    compile_process_free_input(process);
+
+    if (process->ofile)
+    {
+        fclose(process->ofile);
+    }
+
+    vector_free(process->node_vec);
+    vector_free(process->node_tree_vec);
+    ast_free(&process->ast);
+    symresolver_free(process);
+    if (process->scope.root)
+    {
+        scope_free_root(process);
+    }
+    vector_free(process->parser.exp_stack);
+
+    // Histories, symbols and comments all go with the arena
+    arena_free(process->arena);
+    if (process->lex_arena)
+    {
+        arena_free(process->lex_arena);
+    }
+    // Nothing of this compile refers to its atoms any more
+    intern_pool_free(process->intern_pool);
+    free(process);
+}
+
 char compile_process_next_char(struct lex_process *lex_process)
 {
     struct compile_process *compiler = lex_process->compiler;
+    if (compiler->cfile.offset >= compiler->cfile.size)
+    {
+        return EOF;
+    }
+
     compiler->pos.col++;
-    char c = fgetc(compiler->cfile.fp);
+    char c = compiler->cfile.data[compiler->cfile.offset++];
     if (c == '\n')
     {
         compiler->pos.line++;
@@ -51,14 +198,102 @@ char compile_process_next_char(struct lex_process *lex_process)
 char compile_process_peek_char(struct lex_process *lex_process)
 {
     struct compile_process *compiler = lex_process->compiler;
-    char c = getc(compiler->cfile.fp);
-    ungetc(c, compiler->cfile.fp);
-    return c;
+    if (compiler->cfile.offset >= compiler->cfile.size)
+    {
+        return EOF;
+    }
+
+    return compiler->cfile.data[compiler->cfile.offset];
 }
 
 void compile_process_push_char(struct lex_process *lex_process, char c)
 {
     struct compile_process *compiler = lex_process->compiler;
-    ungetc(c, compiler->cfile.fp);
+
+    // The lexer only ever pushes back what it has just read, so stepping
+    // the cursor back is all ungetc would have done for us.
+    assert(compiler->cfile.offset > 0);
+    compiler->cfile.offset--;
+    assert(compiler->cfile.data[compiler->cfile.offset] == c);
     // compiler->pos.col--;
 }
+
+void pos_advance(struct pos *pos, const char *data, size_t len)
+{
+    const char *end = data + len;
+    const char *newline = memchr(data, '\n', len);
+    if (!newline)
+    {
+        pos->col += len;
+        return;
+    }
+
+    while (newline)
+    {
+        pos->line++;
+        data = newline + 1;
+        newline = memchr(data, '\n', end - data);
+    }
+    pos->col = 1 + (end - data);
+}
+
+const char *compile_process_input_span(struct lex_process *lex_process, size_t *len_out)
+{
+    struct compile_process *compiler = lex_process->compiler;
+    *len_out = compiler->cfile.size - compiler->cfile.offset;
+    return compiler->cfile.data + compiler->cfile.offset;
+}
+
+void compile_process_skip_chars(struct lex_process *lex_process, size_t amount)
+{
+    struct compile_process *compiler = lex_process->compiler;
+    assert(amount <= compiler->cfile.size - compiler->cfile.offset);
+    pos_advance(&compiler->pos, compiler->cfile.data + compiler->cfile.offset, amount);
+    compiler->cfile.offset += amount;
+}
+
+struct bracket_span *compile_process_bracket_at(struct compile_process *process, uint32_t start)
+{
+    if (!process->brackets)
+    {
+        return NULL;
+    }
+
+    struct bracket_span *spans = vector_data_ptr(process->brackets);
+    int low = 0;
+    int high = vector_count(process->brackets) - 1;
+    while (low <= high)
+    {
+        int middle = (low + high) / 2;
+        if (spans[middle].start == start)
+        {
+            return &spans[middle];
+        }
+        else if (spans[middle].start < start)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+    return NULL;
+}
+
+const char *compile_process_bracket_text(struct compile_process *process, struct token *token, size_t *len_out)
+{
+    if (!token->between_brackets)
+    {
+        return NULL;
+    }
+
+    struct bracket_span *span = compile_process_bracket_at(process, token->between_brackets - 1);
+    if (!span)
+    {
+        return NULL;
+    }
+
+    *len_out = span->end - token->between_brackets;
+    return process->cfile.data + token->between_brackets;
+}
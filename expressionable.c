@@ -1,22 +1,85 @@
+#include <pthread.h>
+
 #include "compiler.h"
 
 /*
- * Format: {operator1, operator2, operator3, NULL}
+ * Every operator with its precedence group and associativity, indexed by
+ * OPERATOR_* id. See operators.def.
  */
+const struct operator operators[OPERATOR_TOTAL] = {
+    [OPERATOR_NONE] = {.str = NULL, .len = 0, .precedence = -1, .associativity = ASSOCIATIVITY_LEFT_TO_RIGHT, .flags = 0},
+#define OPERATOR(_id, _str, _precedence, _associativity, _flags) \
+    [_id] = {.str = _str, .len = sizeof(_str) - 1, .precedence = _precedence, .associativity = _associativity, .flags = _flags},
+#include "operators.def"
+#undef OPERATOR
+};
+
+// Operators are at most three characters, which pack into one integer key.
+#define OPERATOR_MAX_LENGTH 3
+#define OPERATOR_LOOKUP_BITS 7
+
+static unsigned char operator_lookup_table[1 << OPERATOR_LOOKUP_BITS];
+static const char *operator_atoms[OPERATOR_TOTAL];
+static pthread_once_t operator_init_once = PTHREAD_ONCE_INIT;
+
+static uint32_t operator_key(const char *str, size_t len)
+{
+    uint32_t key = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        key |= (uint32_t)(unsigned char)str[i] << (i * 8);
+    }
+    return key;
+}
+
+static uint32_t operator_slot(uint32_t key)
+{
+    return (uint32_t)(key * 0x9e3779b1u) >> (32 - OPERATOR_LOOKUP_BITS);
+}
+
+static void operator_init()
+{
+    for (int op = OPERATOR_NONE + 1; op < OPERATOR_TOTAL; op++)
+    {
+        uint32_t slot = operator_slot(operator_key(operators[op].str, operators[op].len));
+        while (operator_lookup_table[slot] != OPERATOR_NONE)
+        {
+            slot = (slot + 1) & ((1 << OPERATOR_LOOKUP_BITS) - 1);
+        }
+        operator_lookup_table[slot] = op;
+        operator_atoms[op] = intern_lexicon(operators[op].str, operators[op].len);
+    }
+}
+
+int operator_lookup(const char *str, size_t len)
+{
+    if (len == 0 || len > OPERATOR_MAX_LENGTH)
+    {
+        return OPERATOR_NONE;
+    }
+
+    pthread_once(&operator_init_once, operator_init);
+    uint32_t key = operator_key(str, len);
+    uint32_t slot = operator_slot(key);
+    while (operator_lookup_table[slot] != OPERATOR_NONE)
+    {
+        int op = operator_lookup_table[slot];
+        if (operators[op].len == len && operator_key(operators[op].str, len) == key)
+        {
+            return op;
+        }
+        slot = (slot + 1) & ((1 << OPERATOR_LOOKUP_BITS) - 1);
+    }
+    return OPERATOR_NONE;
+}
 
-struct expressionable_op_precedence_group op_precedence[TOTAL_OPERATOR_GROUPS] = {
-    {.operators = {"++", "--", "()", "[]", "(", "[", ".", "->", NULL}, .associtivity = ASSOCIATIVITY_LEFT_TO_RIGHT},
-    {.operators = {"*", "/", "%", NULL}, .associtivity = ASSOCIATIVITY_LEFT_TO_RIGHT},
-    {.operators = {"+", "-", NULL}, .associtivity = ASSOCIATIVITY_LEFT_TO_RIGHT},
-    {.operators = {"<<", ">>", NULL}, .associtivity = ASSOCIATIVITY_LEFT_TO_RIGHT},
-    {.operators = {"<", "<=", ">", ">=", NULL}, .associtivity = ASSOCIATIVITY_LEFT_TO_RIGHT},
-    {.operators = {"==", "!=", NULL}, .associtivity = ASSOCIATIVITY_LEFT_TO_RIGHT},
-    {.operators = {"&", NULL}, .associtivity = ASSOCIATIVITY_LEFT_TO_RIGHT},
-    {.operators = {"^", NULL}, .associtivity = ASSOCIATIVITY_LEFT_TO_RIGHT},
-    {.operators = {"|", NULL}, .associtivity = ASSOCIATIVITY_LEFT_TO_RIGHT},
-    {.operators = {"&&", NULL}, .associtivity = ASSOCIATIVITY_LEFT_TO_RIGHT},
-    {.operators = {"||", NULL}, .associtivity = ASSOCIATIVITY_LEFT_TO_RIGHT},
-    {.operators = {"?", ":", NULL}, .associtivity = ASSOCIATIVITY_RIGHT_TO_LEFT},
-    {.operators = {"=", "+=", "-=", "*=", "/=", "%=", "<<=", ">>=", "&=", "^=", "|=", NULL}, .associtivity = ASSOCIATIVITY_RIGHT_TO_LEFT},
-    {.operators = {",", NULL}, .associtivity = ASSOCIATIVITY_LEFT_TO_RIGHT}};
+bool operator_has_flag(int op, int flag)
+{
+    return operators[op].flags & flag;
+}
 
+const char *operator_atom(int op)
+{
+    pthread_once(&operator_init_once, operator_init);
+    return operator_atoms[op];
+}
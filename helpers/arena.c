@@ -0,0 +1,110 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define ARENA_ALIGNMENT _Alignof(max_align_t)
+
+static size_t arena_align(size_t size)
+{
+    return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+}
+
+static struct arena_chunk* arena_new_chunk(struct arena* arena, size_t minimum_size)
+{
+    size_t size = arena->chunk_size;
+    if (minimum_size > size)
+    {
+        size = minimum_size;
+    }
+
+    struct arena_chunk* chunk = malloc(sizeof(struct arena_chunk) + size);
+    assert(chunk);
+    chunk->size = size;
+    chunk->used = 0;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    return chunk;
+}
+
+struct arena* arena_create(size_t chunk_size)
+{
+    struct arena* arena = calloc(sizeof(struct arena), 1);
+    arena->chunk_size = chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK_SIZE;
+    return arena;
+}
+
+void* arena_alloc(struct arena* arena, size_t size)
+{
+    size = arena_align(size);
+    struct arena_chunk* chunk = arena->chunks;
+    if (!chunk || chunk->size - chunk->used < size)
+    {
+        chunk = arena_new_chunk(arena, size);
+    }
+
+    void* ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    arena->used += size;
+    arena->total_allocations++;
+    return ptr;
+}
+
+void* arena_calloc(struct arena* arena, size_t size)
+{
+    void* ptr = arena_alloc(arena, size);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+char* arena_strndup(struct arena* arena, const char* str, size_t len)
+{
+    char* copy = arena_alloc(arena, len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+size_t arena_used(struct arena* arena)
+{
+    return arena->used;
+}
+
+void arena_adopt(struct arena* arena, struct arena* other)
+{
+    struct arena_chunk* last = other->chunks;
+    if (last)
+    {
+        while (last->next)
+        {
+            last = last->next;
+        }
+
+        if (arena->chunks)
+        {
+            // Behind the current chunk, so it stays the one allocations come from
+            last->next = arena->chunks->next;
+            arena->chunks->next = other->chunks;
+        }
+        else
+        {
+            arena->chunks = other->chunks;
+        }
+    }
+
+    arena->used += other->used;
+    arena->total_allocations += other->total_allocations;
+    free(other);
+}
+
+void arena_free(struct arena* arena)
+{
+    struct arena_chunk* chunk = arena->chunks;
+    while (chunk)
+    {
+        struct arena_chunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
@@ -0,0 +1,65 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Default size of each block the arena carves allocations out of
+#define ARENA_DEFAULT_CHUNK_SIZE (64 * 1024)
+
+struct arena_chunk
+{
+    struct arena_chunk* next;
+    size_t size;
+    size_t used;
+    _Alignas(max_align_t) char data[];
+};
+
+/**
+ * Bump pointer allocator. Allocations are never freed one by one, everything
+ * goes at once with arena_free.
+ */
+struct arena
+{
+    // Most recent chunk first, allocations come out of this one
+    struct arena_chunk* chunks;
+    size_t chunk_size;
+
+    // Bytes handed out and number of allocations made, for statistics
+    size_t used;
+    size_t total_allocations;
+};
+
+struct arena* arena_create(size_t chunk_size);
+
+/**
+ * Returns size bytes aligned for any type, the memory is not zeroed
+ */
+void* arena_alloc(struct arena* arena, size_t size);
+
+/**
+ * Like arena_alloc but zeroes the memory
+ */
+void* arena_calloc(struct arena* arena, size_t size);
+
+/**
+ * Copies len bytes of str into the arena and null terminates the copy
+ */
+char* arena_strndup(struct arena* arena, const char* str, size_t len);
+
+/**
+ * Returns the number of bytes handed out so far
+ */
+size_t arena_used(struct arena* arena);
+
+/**
+ * Moves every allocation made from other into arena, so they live as long as it
+ * does, and frees other. Allocations carry on from arena's own current chunk.
+ */
+void arena_adopt(struct arena* arena, struct arena* other);
+
+/**
+ * Frees every allocation made from the arena and the arena its self
+ */
+void arena_free(struct arena* arena);
+
+#endif
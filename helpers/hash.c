@@ -0,0 +1,156 @@
+#include <string.h>
+
+#include "hash.h"
+
+#define HASH_FNV_OFFSET_BASIS 2166136261u
+#define HASH_FNV_PRIME 16777619u
+#define HASH_FNV64_PRIME 1099511628211ull
+
+uint32_t hash_string(const char* str, size_t len)
+{
+    uint32_t hash = HASH_FNV_OFFSET_BASIS;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)str[i];
+        hash *= HASH_FNV_PRIME;
+    }
+    return hash;
+}
+
+uint64_t hash_bytes64(uint64_t hash, const void* data, size_t len)
+{
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= bytes[i];
+        hash *= HASH_FNV64_PRIME;
+    }
+    return hash;
+}
+
+static const uint32_t hash_sha256_k[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define HASH_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void hash_sha256_block(struct hash_sha256* sha, const unsigned char* block)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+               (uint32_t)block[i * 4 + 2] << 8 | (uint32_t)block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = HASH_ROTR(w[i - 15], 7) ^ HASH_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = HASH_ROTR(w[i - 2], 17) ^ HASH_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = sha->state[0], b = sha->state[1], c = sha->state[2], d = sha->state[3];
+    uint32_t e = sha->state[4], f = sha->state[5], g = sha->state[6], h = sha->state[7];
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t s1 = HASH_ROTR(e, 6) ^ HASH_ROTR(e, 11) ^ HASH_ROTR(e, 25);
+        uint32_t choice = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + choice + hash_sha256_k[i] + w[i];
+        uint32_t s0 = HASH_ROTR(a, 2) ^ HASH_ROTR(a, 13) ^ HASH_ROTR(a, 22);
+        uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + majority;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    sha->state[0] += a;
+    sha->state[1] += b;
+    sha->state[2] += c;
+    sha->state[3] += d;
+    sha->state[4] += e;
+    sha->state[5] += f;
+    sha->state[6] += g;
+    sha->state[7] += h;
+}
+
+void hash_sha256_begin(struct hash_sha256* sha)
+{
+    static const uint32_t initial_state[8] =
+    {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(sha->state, initial_state, sizeof(initial_state));
+    sha->total_bytes = 0;
+    sha->block_used = 0;
+}
+
+void hash_sha256_update(struct hash_sha256* sha, const void* data, size_t len)
+{
+    const unsigned char* bytes = data;
+    sha->total_bytes += len;
+    if (sha->block_used)
+    {
+        size_t amount = sizeof(sha->block) - sha->block_used;
+        if (amount > len)
+        {
+            amount = len;
+        }
+        memcpy(sha->block + sha->block_used, bytes, amount);
+        sha->block_used += amount;
+        bytes += amount;
+        len -= amount;
+        if (sha->block_used < sizeof(sha->block))
+        {
+            return;
+        }
+        hash_sha256_block(sha, sha->block);
+        sha->block_used = 0;
+    }
+
+    // Whole blocks straight from the input
+    while (len >= sizeof(sha->block))
+    {
+        hash_sha256_block(sha, bytes);
+        bytes += sizeof(sha->block);
+        len -= sizeof(sha->block);
+    }
+    memcpy(sha->block, bytes, len);
+    sha->block_used = len;
+}
+
+void hash_sha256_end(struct hash_sha256* sha, unsigned char* out)
+{
+    uint64_t total_bits = sha->total_bytes * 8;
+    static const unsigned char padding[64] = {0x80};
+    size_t padding_size = sha->block_used < 56 ? 56 - sha->block_used : 120 - sha->block_used;
+    hash_sha256_update(sha, padding, padding_size);
+
+    unsigned char length[8];
+    for (int i = 0; i < 8; i++)
+    {
+        length[i] = (unsigned char)(total_bits >> (56 - i * 8));
+    }
+    hash_sha256_update(sha, length, sizeof(length));
+
+    for (int i = 0; i < 8; i++)
+    {
+        out[i * 4] = (unsigned char)(sha->state[i] >> 24);
+        out[i * 4 + 1] = (unsigned char)(sha->state[i] >> 16);
+        out[i * 4 + 2] = (unsigned char)(sha->state[i] >> 8);
+        out[i * 4 + 3] = (unsigned char)sha->state[i];
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * 32 bit FNV-1a hash of the len bytes at str
+ */
+uint32_t hash_string(const char* str, size_t len);
+
+/**
+ * 64 bit FNV-1a hash of the len bytes at data, continuing from hash. Start with
+ * HASH_FNV64_OFFSET_BASIS.
+ */
+uint64_t hash_bytes64(uint64_t hash, const void* data, size_t len);
+
+#define HASH_FNV64_OFFSET_BASIS 14695981039346656037ull
+
+#define HASH_SHA256_SIZE 32
+
+// A SHA-256 being worked out, for when a collision must never happen
+struct hash_sha256
+{
+    uint32_t state[8];
+    uint64_t total_bytes;
+    unsigned char block[64];
+    size_t block_used;
+};
+
+void hash_sha256_begin(struct hash_sha256* sha);
+/**
+ * Adds the len bytes at data to the hash
+ */
+void hash_sha256_update(struct hash_sha256* sha, const void* data, size_t len);
+/**
+ * Writes the HASH_SHA256_SIZE byte digest of everything added to out
+ */
+void hash_sha256_end(struct hash_sha256* sha, unsigned char* out);
+
+#endif
@@ -0,0 +1,314 @@
+#include "scan.h"
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+// Must stay in line with the identifier class in lexer.c, which leaves out '0'
+static int scan_is_identifier_char(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '1' && c <= '9') || c == '_';
+}
+
+static int scan_is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static size_t scan_identifier_run_scalar(const char* str, size_t len, size_t i)
+{
+    while (i < len && scan_is_identifier_char(str[i]))
+    {
+        i++;
+    }
+    return i;
+}
+
+static size_t scan_digit_run_scalar(const char* str, size_t len, size_t i)
+{
+    while (i < len && scan_is_digit(str[i]))
+    {
+        i++;
+    }
+    return i;
+}
+
+static size_t scan_find_newline_scalar(const char* str, size_t len, size_t i)
+{
+    while (i < len && str[i] != '\n' && str[i] != (char)0xff)
+    {
+        i++;
+    }
+    return i;
+}
+
+static size_t scan_find_comment_end_scalar(const char* str, size_t len, size_t i)
+{
+    for (; i < len; i++)
+    {
+        if (str[i] == (char)0xff || (str[i] == '*' && i + 1 < len && str[i + 1] == '/'))
+        {
+            return i;
+        }
+    }
+    return len;
+}
+
+#ifdef SCAN_X86
+
+/*
+ * The range checks use signed compares. Every bound is plain ASCII and bytes
+ * of 0x80 and up are negative, so they land outside every range as they should.
+ */
+
+static __m128i scan_in_range_sse2(__m128i chars, char low, char high)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8(low - 1)),
+                         _mm_cmplt_epi8(chars, _mm_set1_epi8(high + 1)));
+}
+
+static size_t scan_identifier_run_sse2(const char* str, size_t len)
+{
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i chars = _mm_loadu_si128((const __m128i*)(str + i));
+        // Setting bit 5 folds upper case onto lower case
+        __m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+        __m128i matches = _mm_or_si128(scan_in_range_sse2(lower, 'a', 'z'),
+                                       _mm_or_si128(scan_in_range_sse2(chars, '1', '9'),
+                                                    _mm_cmpeq_epi8(chars, _mm_set1_epi8('_'))));
+        unsigned mask = ~_mm_movemask_epi8(matches) & 0xffff;
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return scan_identifier_run_scalar(str, len, i);
+}
+
+static size_t scan_digit_run_sse2(const char* str, size_t len)
+{
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i chars = _mm_loadu_si128((const __m128i*)(str + i));
+        unsigned mask = ~_mm_movemask_epi8(scan_in_range_sse2(chars, '0', '9')) & 0xffff;
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return scan_digit_run_scalar(str, len, i);
+}
+
+static size_t scan_find_newline_sse2(const char* str, size_t len)
+{
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i chars = _mm_loadu_si128((const __m128i*)(str + i));
+        __m128i matches = _mm_or_si128(_mm_cmpeq_epi8(chars, _mm_set1_epi8('\n')),
+                                       _mm_cmpeq_epi8(chars, _mm_set1_epi8((char)0xff)));
+        unsigned mask = _mm_movemask_epi8(matches);
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return scan_find_newline_scalar(str, len, i);
+}
+
+static size_t scan_find_comment_end_sse2(const char* str, size_t len)
+{
+    size_t i = 0;
+    // Each step compares 16 stars against the 16 bytes one further on
+    for (; i + 17 <= len; i += 16)
+    {
+        __m128i chars = _mm_loadu_si128((const __m128i*)(str + i));
+        __m128i stars = _mm_cmpeq_epi8(chars, _mm_set1_epi8('*'));
+        __m128i slashes = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(str + i + 1)), _mm_set1_epi8('/'));
+        __m128i ends = _mm_or_si128(_mm_and_si128(stars, slashes), _mm_cmpeq_epi8(chars, _mm_set1_epi8((char)0xff)));
+        unsigned mask = _mm_movemask_epi8(ends);
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return scan_find_comment_end_scalar(str, len, i);
+}
+
+__attribute__((target("avx2")))
+static __m256i scan_in_range_avx2(__m256i chars, char low, char high)
+{
+    return _mm256_and_si256(_mm256_cmpgt_epi8(chars, _mm256_set1_epi8(low - 1)),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(high + 1), chars));
+}
+
+__attribute__((target("avx2")))
+static size_t scan_identifier_run_avx2(const char* str, size_t len)
+{
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i chars = _mm256_loadu_si256((const __m256i*)(str + i));
+        __m256i lower = _mm256_or_si256(chars, _mm256_set1_epi8(0x20));
+        __m256i matches = _mm256_or_si256(scan_in_range_avx2(lower, 'a', 'z'),
+                                          _mm256_or_si256(scan_in_range_avx2(chars, '1', '9'),
+                                                          _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('_'))));
+        uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(matches);
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return scan_identifier_run_scalar(str, len, i);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_digit_run_avx2(const char* str, size_t len)
+{
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i chars = _mm256_loadu_si256((const __m256i*)(str + i));
+        uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(scan_in_range_avx2(chars, '0', '9'));
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return scan_digit_run_scalar(str, len, i);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_find_newline_avx2(const char* str, size_t len)
+{
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i chars = _mm256_loadu_si256((const __m256i*)(str + i));
+        __m256i matches = _mm256_or_si256(_mm256_cmpeq_epi8(chars, _mm256_set1_epi8('\n')),
+                                          _mm256_cmpeq_epi8(chars, _mm256_set1_epi8((char)0xff)));
+        uint32_t mask = _mm256_movemask_epi8(matches);
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return scan_find_newline_scalar(str, len, i);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_find_comment_end_avx2(const char* str, size_t len)
+{
+    size_t i = 0;
+    for (; i + 33 <= len; i += 32)
+    {
+        __m256i chars = _mm256_loadu_si256((const __m256i*)(str + i));
+        __m256i stars = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('*'));
+        __m256i slashes = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(str + i + 1)), _mm256_set1_epi8('/'));
+        __m256i ends = _mm256_or_si256(_mm256_and_si256(stars, slashes), _mm256_cmpeq_epi8(chars, _mm256_set1_epi8((char)0xff)));
+        uint32_t mask = _mm256_movemask_epi8(ends);
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return scan_find_comment_end_scalar(str, len, i);
+}
+
+#endif
+
+#ifndef SCAN_X86
+
+static size_t scan_identifier_run_portable(const char* str, size_t len)
+{
+    return scan_identifier_run_scalar(str, len, 0);
+}
+
+static size_t scan_digit_run_portable(const char* str, size_t len)
+{
+    return scan_digit_run_scalar(str, len, 0);
+}
+
+static size_t scan_find_newline_portable(const char* str, size_t len)
+{
+    return scan_find_newline_scalar(str, len, 0);
+}
+
+static size_t scan_find_comment_end_portable(const char* str, size_t len)
+{
+    return scan_find_comment_end_scalar(str, len, 0);
+}
+
+#endif
+
+struct scan_functions
+{
+    size_t (*identifier_run)(const char* str, size_t len);
+    size_t (*digit_run)(const char* str, size_t len);
+    size_t (*find_newline)(const char* str, size_t len);
+    size_t (*find_comment_end)(const char* str, size_t len);
+};
+
+static struct scan_functions scan_functions;
+static pthread_once_t scan_init_once = PTHREAD_ONCE_INIT;
+
+static void scan_init()
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        scan_functions = (struct scan_functions){
+            .identifier_run = scan_identifier_run_avx2,
+            .digit_run = scan_digit_run_avx2,
+            .find_newline = scan_find_newline_avx2,
+            .find_comment_end = scan_find_comment_end_avx2,
+        };
+        return;
+    }
+
+    scan_functions = (struct scan_functions){
+        .identifier_run = scan_identifier_run_sse2,
+        .digit_run = scan_digit_run_sse2,
+        .find_newline = scan_find_newline_sse2,
+        .find_comment_end = scan_find_comment_end_sse2,
+    };
+#else
+    scan_functions = (struct scan_functions){
+        .identifier_run = scan_identifier_run_portable,
+        .digit_run = scan_digit_run_portable,
+        .find_newline = scan_find_newline_portable,
+        .find_comment_end = scan_find_comment_end_portable,
+    };
+#endif
+}
+
+size_t scan_identifier_run(const char* str, size_t len)
+{
+    pthread_once(&scan_init_once, scan_init);
+    return scan_functions.identifier_run(str, len);
+}
+
+size_t scan_digit_run(const char* str, size_t len)
+{
+    pthread_once(&scan_init_once, scan_init);
+    return scan_functions.digit_run(str, len);
+}
+
+size_t scan_find_newline(const char* str, size_t len)
+{
+    pthread_once(&scan_init_once, scan_init);
+    return scan_functions.find_newline(str, len);
+}
+
+size_t scan_find_comment_end(const char* str, size_t len)
+{
+    pthread_once(&scan_init_once, scan_init);
+    return scan_functions.find_comment_end(str, len);
+}
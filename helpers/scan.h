@@ -0,0 +1,36 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+/*
+ * Character class scanners over a block of memory. On x86 these look at 16
+ * bytes at a time with SSE2, or 32 with AVX2 when the processor has it. The
+ * choice is made once, the first time any of them is called.
+ *
+ * None of them read past str + len.
+ */
+
+/**
+ * Returns the length of the run of identifier characters at the start of str
+ */
+size_t scan_identifier_run(const char* str, size_t len);
+
+/**
+ * Returns the length of the run of decimal digits at the start of str
+ */
+size_t scan_digit_run(const char* str, size_t len);
+
+/**
+ * Returns the index of the first newline, or of the first 0xff byte the lexer
+ * reads as EOF. Returns len if there is neither.
+ */
+size_t scan_find_newline(const char* str, size_t len);
+
+/**
+ * Returns the index of the * of the first star slash, or of the first 0xff byte
+ * the lexer reads as EOF. Returns len if there is neither.
+ */
+size_t scan_find_comment_end(const char* str, size_t len);
+
+#endif
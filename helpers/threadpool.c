@@ -0,0 +1,205 @@
+#include "threadpool.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <assert.h>
+
+static void threadpool_job_taken(struct threadpool* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->queued--;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void threadpool_worker_reset_if_empty(struct threadpool_worker* worker)
+{
+    if (worker->head == vector_count(worker->jobs))
+    {
+        vector_clear(worker->jobs);
+        worker->head = 0;
+    }
+}
+
+static bool threadpool_worker_take_front(struct threadpool_worker* worker, struct threadpool_job* job_out)
+{
+    bool found = false;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->head < vector_count(worker->jobs))
+    {
+        *job_out = *(struct threadpool_job*)vector_at(worker->jobs, worker->head);
+        worker->head++;
+        threadpool_worker_reset_if_empty(worker);
+        found = true;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return found;
+}
+
+static bool threadpool_worker_steal_back(struct threadpool_worker* worker, struct threadpool_job* job_out)
+{
+    bool found = false;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->head < vector_count(worker->jobs))
+    {
+        *job_out = *(struct threadpool_job*)vector_back(worker->jobs);
+        vector_pop(worker->jobs);
+        threadpool_worker_reset_if_empty(worker);
+        found = true;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return found;
+}
+
+static bool threadpool_find_job(struct threadpool_worker* worker, struct threadpool_job* job_out)
+{
+    struct threadpool* pool = worker->pool;
+    if (threadpool_worker_take_front(worker, job_out))
+    {
+        return true;
+    }
+
+    // Our own queue is empty, go and steal from somebody else
+    for (int i = 1; i < pool->total_workers; i++)
+    {
+        struct threadpool_worker* victim = &pool->workers[(worker->index + i) % pool->total_workers];
+        if (threadpool_worker_steal_back(victim, job_out))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void* threadpool_worker_main(void* arg)
+{
+    struct threadpool_worker* worker = arg;
+    struct threadpool* pool = worker->pool;
+    while (1)
+    {
+        struct threadpool_job job;
+        if (threadpool_find_job(worker, &job))
+        {
+            threadpool_job_taken(pool);
+            job.function(job.arg);
+
+            pthread_mutex_lock(&pool->lock);
+            pool->pending--;
+            if (pool->pending == 0)
+            {
+                pthread_cond_broadcast(&pool->work_done);
+            }
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        // queued can briefly dip below zero when a job is taken before
+        // threadpool_submit got round to counting it
+        while (pool->queued <= 0 && !pool->shutdown)
+        {
+            pthread_cond_wait(&pool->work_available, &pool->lock);
+        }
+
+        bool finished = pool->shutdown && pool->queued <= 0;
+        pthread_mutex_unlock(&pool->lock);
+        if (finished)
+        {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+int threadpool_total_processors(void)
+{
+    long total = sysconf(_SC_NPROCESSORS_ONLN);
+    return total < 1 ? 1 : (int)total;
+}
+
+struct threadpool* threadpool_create(int total_workers)
+{
+    assert(total_workers > 0);
+    struct threadpool* pool = calloc(sizeof(struct threadpool), 1);
+    pool->workers = calloc(sizeof(struct threadpool_worker), total_workers);
+    pool->total_workers = total_workers;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_available, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+
+    for (int i = 0; i < total_workers; i++)
+    {
+        struct threadpool_worker* worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        worker->jobs = vector_create(sizeof(struct threadpool_job));
+        pthread_mutex_init(&worker->lock, NULL);
+    }
+
+    // Only start the threads once every queue exists, they steal from each other
+    for (int i = 0; i < total_workers; i++)
+    {
+        pthread_create(&pool->workers[i].thread, NULL, threadpool_worker_main, &pool->workers[i]);
+    }
+
+    return pool;
+}
+
+void threadpool_submit(struct threadpool* pool, THREADPOOL_JOB_FUNCTION function, void* arg)
+{
+    struct threadpool_job job = {.function = function, .arg = arg};
+
+    pthread_mutex_lock(&pool->lock);
+    struct threadpool_worker* worker = &pool->workers[pool->next_worker];
+    pool->next_worker = (pool->next_worker + 1) % pool->total_workers;
+    pool->pending++;
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_mutex_lock(&worker->lock);
+    vector_push(worker->jobs, &job);
+    pthread_mutex_unlock(&worker->lock);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->queued++;
+    pthread_cond_signal(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void threadpool_wait(struct threadpool* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0)
+    {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void threadpool_free(struct threadpool* pool)
+{
+    threadpool_wait(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->work_available);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->total_workers; i++)
+    {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    // Only once every worker is gone, until then they may still look in each other's queues
+    for (int i = 0; i < pool->total_workers; i++)
+    {
+        struct threadpool_worker* worker = &pool->workers[i];
+        pthread_mutex_destroy(&worker->lock);
+        vector_free(worker->jobs);
+    }
+
+    pthread_cond_destroy(&pool->work_available);
+    pthread_cond_destroy(&pool->work_done);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,77 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "vector.h"
+
+typedef void (*THREADPOOL_JOB_FUNCTION)(void* arg);
+
+struct threadpool_job
+{
+    THREADPOOL_JOB_FUNCTION function;
+    void* arg;
+};
+
+struct threadpool;
+struct threadpool_worker
+{
+    pthread_t thread;
+    struct threadpool* pool;
+    int index;
+
+    // Double ended queue of struct threadpool_job. The owning worker takes jobs
+    // from the front (jobs[head]), other workers steal from the back.
+    pthread_mutex_t lock;
+    struct vector* jobs;
+    int head;
+};
+
+struct threadpool
+{
+    struct threadpool_worker* workers;
+    int total_workers;
+
+    // Next worker to hand a submitted job to
+    int next_worker;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_available;
+    pthread_cond_t work_done;
+
+    // Jobs sitting in a queue waiting for a worker
+    int queued;
+    // Jobs submitted that have not finished running yet
+    int pending;
+    bool shutdown;
+};
+
+/**
+ * Creates a pool of total_workers threads. Each worker owns a queue of jobs and
+ * steals from the other workers when its own queue runs dry.
+ */
+struct threadpool* threadpool_create(int total_workers);
+
+/**
+ * Submits a job. Jobs are dealt out to the workers round robin, so submitting
+ * the most expensive jobs first gets them started first.
+ */
+void threadpool_submit(struct threadpool* pool, THREADPOOL_JOB_FUNCTION function, void* arg);
+
+/**
+ * Blocks until every submitted job has finished running
+ */
+void threadpool_wait(struct threadpool* pool);
+
+/**
+ * Waits for outstanding jobs then joins and frees all workers
+ */
+void threadpool_free(struct threadpool* pool);
+
+/**
+ * Returns the number of processors online, never less than one
+ */
+int threadpool_total_processors(void);
+
+#endif
@@ -29,6 +29,7 @@ struct vector *vector_create_no_saves(size_t esize)
     vector->pindex = 0;
     vector->esize = esize;
     vector->count = 0;
+    vector->total_allocations = 1;
     return vector;
 }
 
@@ -49,6 +50,8 @@ struct vector *vector_clone(struct vector *vector)
     struct vector *new_vec = calloc(sizeof(struct vector), 1);
     memcpy(new_vec, vector, sizeof(struct vector));
     new_vec->data = new_data_address;
+    new_vec->mindex = vector->count + VECTOR_ELEMENT_INCREMENT;
+    new_vec->total_allocations = 1;
 
     // Saves are not cloned with vector_clone yet.
     // assert(vector->saves == NULL);
@@ -64,6 +67,10 @@ struct vector *vector_create(size_t esize)
 
 void vector_free(struct vector *vector)
 {
+    if (vector->saves)
+    {
+        vector_free(vector->saves);
+    }
     free(vector->data);
     free(vector);
 }
@@ -73,6 +80,14 @@ int vector_current_index(struct vector *vector)
     return vector->rindex;
 }
 
+static void vector_set_capacity(struct vector *vector, int total_elements)
+{
+    vector->data = realloc(vector->data, total_elements * vector->esize);
+    assert(vector->data);
+    vector->mindex = total_elements;
+    vector->total_allocations++;
+}
+
 void vector_resize_for_index(struct vector *vector, int start_index, int total_elements)
 {
     if (start_index + total_elements < vector->mindex)
@@ -81,9 +96,23 @@ void vector_resize_for_index(struct vector *vector, int start_index, int total_e
         return;
     }
 
-    vector->data = realloc(vector->data, ((start_index + total_elements + VECTOR_ELEMENT_INCREMENT) * vector->esize));
-    assert(vector->data);
-    vector->mindex = start_index + total_elements;
+    // At least double, so pushing n elements copies O(n) of them in total
+    int capacity = vector->mindex * 2;
+    if (capacity <= start_index + total_elements)
+    {
+        capacity = start_index + total_elements + VECTOR_ELEMENT_INCREMENT;
+    }
+    vector_set_capacity(vector, capacity);
+}
+
+void vector_reserve(struct vector *vector, int total_elements)
+{
+    // vector_push needs a free element past the last one
+    if (total_elements < vector->mindex)
+    {
+        return;
+    }
+    vector_set_capacity(vector, total_elements + 1);
 }
 
 void vector_resize_for(struct vector *vector, int total_elements)
@@ -217,6 +246,9 @@ void vector_restore(struct vector *vector)
 {
     struct vector save_vec = *((struct vector *)(vector_back(vector->saves)));
     save_vec.saves = vector->saves;
+    // The data may have moved since the save
+    save_vec.data = vector->data;
+    save_vec.mindex = vector->mindex;
     *vector = save_vec;
     vector_pop(vector->saves);
 }
@@ -280,10 +312,11 @@ int vector_elements_until_end(struct vector *vector, int index)
 
 void vector_shift_right_in_bounds_no_increment(struct vector *vector, int index, int amount)
 {
-    vector_resize_for_index(vector, index, amount);
+    // Everything from index on moves, so room is needed past the current end
+    vector_resize_for_index(vector, vector->rindex, amount);
     int eindex = (index + amount);
     size_t bytes_to_move = vector_elements_until_end(vector, index) * vector->esize;
-    memcpy(vector_at(vector, eindex), vector_at(vector, index), bytes_to_move);
+    memmove(vector_at(vector, eindex), vector_at(vector, index), bytes_to_move);
     memset(vector_at(vector, index), 0x00, amount * vector->esize);
 }
 
@@ -352,11 +385,24 @@ void vector_pop_at(struct vector *vector, int index)
     void *next_element_pos = dst_pos + vector->esize;
     void *end_pos = vector_data_end(vector);
     size_t total = (size_t)end_pos - (size_t)next_element_pos;
-    memcpy(dst_pos, next_element_pos, total);
+    memmove(dst_pos, next_element_pos, total);
     vector->count -= 1;
     vector->rindex -= 1;
 }
 
+void vector_replace(struct vector *vector, int index, int total_removed, void *elements, int total_elements)
+{
+    assert(index >= 0 && index + total_removed <= vector->count);
+    int count = vector->count - total_removed + total_elements;
+    vector_resize_for_index(vector, count, 0);
+
+    size_t bytes_after = (vector->count - index - total_removed) * vector->esize;
+    memmove(vector_at(vector, index + total_elements), vector_at(vector, index + total_removed), bytes_after);
+    memcpy(vector_at(vector, index), elements, total_elements * vector->esize);
+    vector->count = count;
+    vector->rindex = count;
+}
+
 void vector_peek_pop(struct vector *vector)
 {
     // Popping at a peek is an akward one
@@ -455,4 +501,9 @@ void *vector_back(struct vector *vector)
 int vector_count(struct vector *vector)
 {
     return vector->count;
+}
+
+size_t vector_memory_usage(struct vector *vector)
+{
+    return sizeof(struct vector) + vector->mindex * vector->esize;
 }
\ No newline at end of file
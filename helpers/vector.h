@@ -6,9 +6,10 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <assert.h>
 
-// We want at least 20 vector element spaces in reserve before having
-// to reallocate memory again
+// Room for 20 elements to start with, after that the capacity doubles
+// whenever it runs out
 #define VECTOR_ELEMENT_INCREMENT 20
 
 enum
@@ -27,6 +28,7 @@ struct vector
     int count;
     int flags;
     size_t esize;
+    size_t total_allocations;  // times data has been allocated, growth included
 
 
     // Vector of struct vector, holds saves of this vector. YOu can save the internal state
@@ -40,6 +42,10 @@ struct vector
 
 struct vector* vector_create(size_t esize);
 void vector_free(struct vector* vector);
+/**
+ * Makes room for total_elements, so pushing up to that many never reallocates
+ */
+void vector_reserve(struct vector* vector, int total_elements);
 void* vector_at(struct vector* vector, int index);
 void* vector_peek_ptr_at(struct vector* vector, int index);
 void* vector_peek_no_increment(struct vector* vector);
@@ -84,6 +90,10 @@ bool vector_empty(struct vector* vector);
 void vector_clear(struct vector* vector);
 
 int vector_count(struct vector* vector);
+/**
+ * Bytes the vector holds, the room for elements not yet pushed included
+ */
+size_t vector_memory_usage(struct vector* vector);
 /**
  * freads from the file directly into the vector
  */
@@ -110,6 +120,12 @@ int vector_pop_value(struct vector* vector, void* val);
 
 void vector_pop_at(struct vector *vector, int index);
 
+/**
+ * Replaces the total_removed elements from index on with total_elements elements
+ * copied from elements, moving whatever comes after them along.
+ */
+void vector_replace(struct vector *vector, int index, int total_removed, void *elements, int total_elements);
+
 /**
  * Decrements the peek pointer so that the next peek
  * will point at the last peeked token
@@ -148,4 +164,68 @@ size_t vector_element_size(struct vector* vector);
  */
 struct vector* vector_clone(struct vector* vector);
 
+/**
+ * Grows the vector if the last push used up its room
+ */
+void vector_resize(struct vector* vector);
+
+/*
+ * Typed accessors for a vector whose elements are all of one type, e.g.
+ *
+ *     VECTOR_DEFINE_TYPED(token, struct token)
+ *
+ * defines token_vector_at, token_vector_peek and friends. They work on the
+ * same struct vector as the functions above and can be mixed with them, but
+ * they are static inline and index with the element type, so the element size
+ * is known at compile time.
+ */
+#define VECTOR_DEFINE_TYPED(name, type)                                              \
+    static inline type *name##_vector_at(struct vector *vector, int index)           \
+    {                                                                                \
+        return (type *)vector->data + index;                                         \
+    }                                                                                \
+                                                                                     \
+    static inline type *name##_vector_peek_no_increment(struct vector *vector)       \
+    {                                                                                \
+        if (vector->pindex < 0 || vector->pindex >= vector->rindex)                  \
+        {                                                                            \
+            return NULL;                                                             \
+        }                                                                            \
+        return name##_vector_at(vector, vector->pindex);                             \
+    }                                                                                \
+                                                                                     \
+    static inline type *name##_vector_peek(struct vector *vector)                    \
+    {                                                                                \
+        type *ptr = name##_vector_peek_no_increment(vector);                         \
+        if (ptr)                                                                     \
+        {                                                                            \
+            vector->pindex += (vector->flags & VECTOR_FLAG_PEEK_DECREMENT) ? -1 : 1; \
+        }                                                                            \
+        return ptr;                                                                  \
+    }                                                                                \
+                                                                                     \
+    static inline type *name##_vector_back_or_null(struct vector *vector)            \
+    {                                                                                \
+        return vector->rindex > 0 ? name##_vector_at(vector, vector->rindex - 1) : NULL; \
+    }                                                                                \
+                                                                                     \
+    static inline void name##_vector_push(struct vector *vector, type value)         \
+    {                                                                                \
+        *name##_vector_at(vector, vector->rindex) = value;                           \
+        vector->rindex++;                                                            \
+        vector->count++;                                                             \
+        if (vector->rindex >= vector->mindex)                                        \
+        {                                                                            \
+            vector_resize(vector);                                                   \
+        }                                                                            \
+    }                                                                                \
+                                                                                     \
+    static inline type name##_vector_pop(struct vector *vector)                      \
+    {                                                                                \
+        assert(vector->rindex > 0);                                                  \
+        vector->rindex--;                                                            \
+        vector->count--;                                                             \
+        return *name##_vector_at(vector, vector->rindex);                            \
+    }
+
 #endif
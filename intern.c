@@ -0,0 +1,258 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <assert.h>
+
+#include "compiler.h"
+#include "helpers/hash.h"
+#include "helpers/arena.h"
+
+/*
+ * String interning pools.
+ *
+ * Every distinct spelling is stored exactly once in a pool, as an atom.
+ * intern_string returns a pointer to the characters of the atom, so two strings
+ * interned in the same pool are equal if and only if they are the same pointer.
+ * The hash and length sit just in front of the characters and can be read back
+ * with intern_hash and intern_length.
+ *
+ * Every compile interns into a pool of its own, made by compile_process_create
+ * and freed with the rest of the compile, so a process that goes on compiling
+ * only holds the atoms of the compiles still running. The threads lexing one
+ * input share its pool, so it is split into shards, each with its own lock.
+ *
+ * The spellings of the language itself, keywords and operators, are interned
+ * once for the whole process in the lexicon. Pools hand out the lexicon's atom
+ * for those instead of one of their own, so operator_atom is the same pointer
+ * as any operator interned in any compile.
+ */
+
+#define INTERN_SHARD_BITS 4
+#define INTERN_TOTAL_SHARDS (1 << INTERN_SHARD_BITS)
+#define INTERN_INITIAL_BUCKETS 64
+#define INTERN_CHUNK_SIZE (16 * 1024)
+
+struct atom
+{
+    struct atom *next;  // next atom in the same bucket
+    uint32_t hash;
+    uint32_t len;
+    char str[];
+};
+
+struct intern_shard
+{
+    pthread_mutex_t lock;
+    struct atom **buckets;
+    size_t total_buckets;
+    size_t total_atoms;
+
+    // Atoms are bump allocated and all go with the pool
+    struct arena *atoms;
+};
+
+struct intern_pool
+{
+    struct intern_shard shards[INTERN_TOTAL_SHARDS];
+};
+
+// Never changes once filled in, so it is read without taking any lock
+static struct intern_pool intern_lexicon_pool;
+static pthread_once_t intern_lexicon_once = PTHREAD_ONCE_INIT;
+
+static struct atom *intern_atom_of(const char *str)
+{
+    return (struct atom *)(str - offsetof(struct atom, str));
+}
+
+// The top bits pick the shard, the low bits pick the bucket inside it.
+static struct intern_shard *intern_shard_for(struct intern_pool *pool, uint32_t hash)
+{
+    return &pool->shards[hash >> (32 - INTERN_SHARD_BITS)];
+}
+
+static void intern_pool_init(struct intern_pool *pool)
+{
+    for (int i = 0; i < INTERN_TOTAL_SHARDS; i++)
+    {
+        struct intern_shard *shard = &pool->shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->buckets = calloc(INTERN_INITIAL_BUCKETS, sizeof(struct atom *));
+        shard->total_buckets = INTERN_INITIAL_BUCKETS;
+        shard->total_atoms = 0;
+        shard->atoms = arena_create(INTERN_CHUNK_SIZE);
+    }
+}
+
+static void intern_shard_grow(struct intern_shard *shard)
+{
+    size_t total_buckets = shard->total_buckets * 2;
+    struct atom **buckets = calloc(total_buckets, sizeof(struct atom *));
+    for (size_t i = 0; i < shard->total_buckets; i++)
+    {
+        struct atom *atom = shard->buckets[i];
+        while (atom)
+        {
+            struct atom *next = atom->next;
+            size_t index = atom->hash & (total_buckets - 1);
+            atom->next = buckets[index];
+            buckets[index] = atom;
+            atom = next;
+        }
+    }
+
+    free(shard->buckets);
+    shard->buckets = buckets;
+    shard->total_buckets = total_buckets;
+}
+
+static struct atom *intern_shard_find(struct intern_shard *shard, const char *str, size_t len, uint32_t hash)
+{
+    struct atom *atom = shard->buckets[hash & (shard->total_buckets - 1)];
+    while (atom)
+    {
+        if (atom->hash == hash && atom->len == len && memcmp(atom->str, str, len) == 0)
+        {
+            return atom;
+        }
+        atom = atom->next;
+    }
+    return NULL;
+}
+
+static struct atom *intern_shard_add(struct intern_shard *shard, const char *str, size_t len, uint32_t hash)
+{
+    if (shard->total_atoms >= shard->total_buckets)
+    {
+        intern_shard_grow(shard);
+    }
+
+    struct atom *atom = arena_alloc(shard->atoms, sizeof(struct atom) + len + 1);
+    atom->hash = hash;
+    atom->len = len;
+    memcpy(atom->str, str, len);
+    atom->str[len] = '\0';
+
+    size_t index = hash & (shard->total_buckets - 1);
+    atom->next = shard->buckets[index];
+    shard->buckets[index] = atom;
+    shard->total_atoms++;
+    return atom;
+}
+
+static void intern_lexicon_add(const char *str, size_t len)
+{
+    uint32_t hash = hash_string(str, len);
+    struct intern_shard *shard = intern_shard_for(&intern_lexicon_pool, hash);
+    if (!intern_shard_find(shard, str, len, hash))
+    {
+        intern_shard_add(shard, str, len, hash);
+    }
+}
+
+static void intern_lexicon_init()
+{
+    intern_pool_init(&intern_lexicon_pool);
+#define KEYWORD(id, str, flags) intern_lexicon_add(str, sizeof(str) - 1);
+#include "keywords.def"
+#undef KEYWORD
+#define OPERATOR(id, str, precedence, associativity, flags) intern_lexicon_add(str, sizeof(str) - 1);
+#include "operators.def"
+#undef OPERATOR
+}
+
+// The lexicon's atom for the spelling, NULL if it isn't a keyword or operator
+static struct atom *intern_lexicon_find(const char *str, size_t len, uint32_t hash)
+{
+    pthread_once(&intern_lexicon_once, intern_lexicon_init);
+    return intern_shard_find(intern_shard_for(&intern_lexicon_pool, hash), str, len, hash);
+}
+
+struct intern_pool *intern_pool_create()
+{
+    struct intern_pool *pool = malloc(sizeof(struct intern_pool));
+    intern_pool_init(pool);
+    return pool;
+}
+
+void intern_pool_free(struct intern_pool *pool)
+{
+    for (int i = 0; i < INTERN_TOTAL_SHARDS; i++)
+    {
+        struct intern_shard *shard = &pool->shards[i];
+        pthread_mutex_destroy(&shard->lock);
+        free(shard->buckets);
+        arena_free(shard->atoms);
+    }
+    free(pool);
+}
+
+size_t intern_pool_memory_usage(struct intern_pool *pool)
+{
+    size_t bytes = 0;
+    for (int i = 0; i < INTERN_TOTAL_SHARDS; i++)
+    {
+        struct intern_shard *shard = &pool->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        bytes += shard->total_buckets * sizeof(struct atom *) + arena_used(shard->atoms);
+        pthread_mutex_unlock(&shard->lock);
+    }
+    return bytes;
+}
+
+const char *intern_string_hashed(struct intern_pool *pool, const char *str, size_t len, uint32_t hash)
+{
+    struct atom *atom = intern_lexicon_find(str, len, hash);
+    if (atom)
+    {
+        return atom->str;
+    }
+
+    struct intern_shard *shard = intern_shard_for(pool, hash);
+    pthread_mutex_lock(&shard->lock);
+    atom = intern_shard_find(shard, str, len, hash);
+    if (!atom)
+    {
+        atom = intern_shard_add(shard, str, len, hash);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return atom->str;
+}
+
+const char *intern_string(struct intern_pool *pool, const char *str, size_t len)
+{
+    return intern_string_hashed(pool, str, len, hash_string(str, len));
+}
+
+const char *intern_lexicon(const char *str, size_t len)
+{
+    struct atom *atom = intern_lexicon_find(str, len, hash_string(str, len));
+    return atom ? atom->str : NULL;
+}
+
+uint32_t intern_hash(const char *interned)
+{
+    return intern_atom_of(interned)->hash;
+}
+
+size_t intern_length(const char *interned)
+{
+    return intern_atom_of(interned)->len;
+}
+
+bool intern_equals(const char *interned, const char *str)
+{
+    if (!interned || !str)
+    {
+        return false;
+    }
+
+    if (interned == str)
+    {
+        return true;
+    }
+
+    // Bounded by the stored length, so str never needs a strlen
+    size_t len = intern_length(interned);
+    return strncmp(interned, str, len) == 0 && str[len] == '\0';
+}
@@ -0,0 +1,41 @@
+#include "compiler.h"
+#include "helpers/hash.h"
+
+// Generated at build time by tools/keyword_hash_gen.c
+#include "build/keyword_hash.h"
+
+const struct keyword keywords[KEYWORD_TOTAL] = {
+    [KEYWORD_NONE] = {.str = NULL, .len = 0, .flags = 0},
+#define KEYWORD(_id, _str, _flags) [_id] = {.str = _str, .len = sizeof(_str) - 1, .flags = _flags},
+#include "keywords.def"
+#undef KEYWORD
+};
+
+int keyword_lookup_hashed(const char *str, size_t len, uint32_t hash)
+{
+    uint32_t slot = (uint32_t)(hash * KEYWORD_HASH_MULTIPLIER) >> (32 - KEYWORD_HASH_BITS);
+    int id = keyword_hash_table[slot];
+    if (id == KEYWORD_NONE)
+    {
+        return KEYWORD_NONE;
+    }
+
+    // The slot is only a candidate, identifiers can hash to it too.
+    const struct keyword *keyword = &keywords[id];
+    if (keyword->len != len || memcmp(keyword->str, str, len) != 0)
+    {
+        return KEYWORD_NONE;
+    }
+
+    return id;
+}
+
+int keyword_lookup(const char *str, size_t len)
+{
+    return keyword_lookup_hashed(str, len, hash_string(str, len));
+}
+
+bool keyword_has_flag(int keyword, int flag)
+{
+    return keywords[keyword].flags & flag;
+}
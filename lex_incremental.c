@@ -0,0 +1,303 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "compiler.h"
+#include "helpers/vector.h"
+
+/*
+ * Lexing an edited text again without starting from the top.
+ *
+ * Once the lexer has made a newline token, the brackets still open are all it
+ * remembers from before it. So lexing can start over at any newline token as
+ * if the input began there, and relexing starts at the last one before the
+ * edit. It stops at the first newline token it makes in the unchanged text
+ * after the edit that the old tokens have at the same place too: from there
+ * on the lexer would only make the old tokens again, so those are kept and
+ * moved along by however much the text grew or shrank. The brackets are then
+ * done again from where relexing started.
+ */
+
+// Reads the edited text, keeping the compiler's position up to date for error messages
+struct lex_relex_input
+{
+    struct compile_process *compiler;
+    const char *source;
+    size_t size;
+    size_t position;
+};
+
+static char lex_relex_next_char(struct lex_process *lex_process)
+{
+    struct lex_relex_input *input = lex_process_private(lex_process);
+    if (input->position >= input->size)
+    {
+        return EOF;
+    }
+
+    struct pos *pos = &input->compiler->pos;
+    pos->col++;
+    char c = input->source[input->position++];
+    if (c == '\n')
+    {
+        pos->line++;
+        pos->col = 1;
+    }
+    return c;
+}
+
+static char lex_relex_peek_char(struct lex_process *lex_process)
+{
+    struct lex_relex_input *input = lex_process_private(lex_process);
+    if (input->position >= input->size)
+    {
+        return EOF;
+    }
+    return input->source[input->position];
+}
+
+static void lex_relex_push_char(struct lex_process *lex_process, char c)
+{
+    (void)c;
+    struct lex_relex_input *input = lex_process_private(lex_process);
+    assert(input->position > 0);
+    input->position--;
+}
+
+static const char *lex_relex_input_span(struct lex_process *lex_process, size_t *len_out)
+{
+    struct lex_relex_input *input = lex_process_private(lex_process);
+    *len_out = input->size - input->position;
+    return input->source + input->position;
+}
+
+static void lex_relex_skip_chars(struct lex_process *lex_process, size_t amount)
+{
+    struct lex_relex_input *input = lex_process_private(lex_process);
+    pos_advance(&input->compiler->pos, input->source + input->position, amount);
+    input->position += amount;
+}
+
+static struct lex_process_functions lex_relex_functions =
+{
+    .next_char = lex_relex_next_char,
+    .peek_char = lex_relex_peek_char,
+    .push_char = lex_relex_push_char,
+    .input_span = lex_relex_input_span,
+    .skip_chars = lex_relex_skip_chars,
+};
+
+// Index of the first token that starts at or after offset, the token count if none does
+static int lex_relex_token_at(struct token_store *store, uint32_t offset)
+{
+    int low = 0;
+    int high = token_store_count(store);
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        if (token_store_offset(store, middle) < offset)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Index of the first bracket that opens at or after offset
+static int lex_relex_bracket_at(struct vector *brackets, uint32_t offset)
+{
+    int low = 0;
+    int high = vector_count(brackets);
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        if (((struct bracket_span *)vector_at(brackets, middle))->start < offset)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/*
+ * Puts the brackets back the way they were when the lexer stood at start,
+ * outermost being where the outermost one still open there starts plus one,
+ * or 0 if none was.
+ */
+static void lex_relex_reopen_brackets(struct lex_process *lex_process, uint32_t start, uint32_t outermost)
+{
+    struct vector *brackets = lex_process->brackets;
+    int total_before = lex_relex_bracket_at(brackets, start);
+    while (vector_count(brackets) > total_before)
+    {
+        vector_pop(brackets);
+    }
+
+    vector_clear(lex_process->open_brackets);
+    lex_process->current_expression_count = 0;
+    if (!outermost)
+    {
+        return;
+    }
+
+    // The ones open at start are nested in the outermost, and close at or after it
+    for (int i = lex_relex_bracket_at(brackets, outermost - 1); i < total_before; i++)
+    {
+        struct bracket_span *span = vector_at(brackets, i);
+        if (span->end >= start)
+        {
+            span->end = UINT32_MAX;
+            vector_push(lex_process->open_brackets, &i);
+            lex_process->current_expression_count++;
+        }
+    }
+}
+
+int lex_relex(struct lex_process *lex_process, const char *source, size_t size, struct lex_edit *edit)
+{
+    assert(lex_process->finished && lex_process_keeps_token_store(lex_process));
+    struct compile_process *compiler = lex_process->compiler;
+    struct token_store *store = lex_process->token_store;
+    // The removed text lies in the old source, the inserted text in the new one
+    assert((uint64_t)edit->offset + edit->total_removed <= store->size);
+    assert((uint64_t)edit->offset + edit->total_inserted <= size);
+    assert(store->size - edit->total_removed == size - edit->total_inserted);
+    int total_tokens = token_store_count(store);
+    int32_t offset_delta = (int32_t)edit->total_inserted - (int32_t)edit->total_removed;
+
+    // Start over at the newline token before the edit, or at the top if there is none
+    int first = lex_relex_token_at(store, edit->offset) - 1;
+    while (first >= 0 && token_store_type(store, first) != TOKEN_TYPE_NEWLINE)
+    {
+        first--;
+    }
+
+    struct lex_relex_input input = {.compiler = compiler, .source = source, .size = size};
+    struct pos saved_pos = compiler->pos;
+    uint32_t outermost = 0;
+    int line = 1;
+    if (first >= 0)
+    {
+        input.position = token_store_offset(store, first);
+        outermost = token_store_between_brackets(store, first);
+        line = token_store_pos(store, first).line;
+    }
+    else
+    {
+        first = 0;
+    }
+
+    uint32_t start = input.position;
+    struct lex_process *relexer = lex_process_create(compiler, &lex_relex_functions, &input);
+    relexer->flags |= LEX_PROCESS_FLAG_NO_BRACKETS;
+    lex_begin(relexer);
+    relexer->offset = start;
+    relexer->pos.line = line;
+    compiler->pos.line = line;
+    compiler->pos.col = 1;
+
+    // A lexing error is reported the same as lex would, the relexer mustn't leak
+    jmp_buf *outer_recovery = compiler->error_recovery;
+    jmp_buf error_recovery;
+    if (setjmp(error_recovery))
+    {
+        compiler->error_recovery = outer_recovery;
+        lex_process_free(relexer);
+        if (!outer_recovery)
+        {
+            exit(-1);
+        }
+        longjmp(*outer_recovery, 1);
+    }
+    compiler->error_recovery = &error_recovery;
+
+    // The old tokens past the edit, in the order the relexer can catch up with them
+    uint32_t unchanged_from = edit->offset + edit->total_inserted;
+    int old_index = lex_relex_token_at(store, edit->offset + edit->total_removed);
+    int resync = -1;
+    while (resync < 0 && lex_step(relexer))
+    {
+        struct token *token = token_vector_back_or_null(relexer->tokens);
+        uint32_t offset = relexer->last_token_offset;
+        if (token->type != TOKEN_TYPE_NEWLINE || offset < unchanged_from)
+        {
+            continue;
+        }
+
+        uint32_t old_offset = offset - offset_delta;
+        while (old_index < total_tokens && token_store_offset(store, old_index) < old_offset)
+        {
+            old_index++;
+        }
+        if (old_index < total_tokens &&
+            token_store_offset(store, old_index) == old_offset &&
+            token_store_type(store, old_index) == TOKEN_TYPE_NEWLINE)
+        {
+            resync = old_index;
+            // The old one stays, its whitespace is already right
+            lex_pop_token(relexer);
+        }
+    }
+    compiler->error_recovery = outer_recovery;
+
+    uint32_t end_offset = resync >= 0 ? lex_process->offset + offset_delta : relexer->offset;
+    struct pos end_pos = resync >= 0 ? lex_process->pos : relexer->pos;
+    int resync_line = resync >= 0 ? token_store_pos(store, resync).line : 0;
+
+    int total_old = (resync >= 0 ? resync : total_tokens) - first;
+    int total_new = token_store_count(relexer->token_store);
+    token_store_replace(store, first, total_old, relexer->token_store, offset_delta);
+    token_store_set_source(store, source, size);
+    lex_process_free(relexer);
+    if (resync >= 0)
+    {
+        // The lexer stopped where it did before, as many lines down as the kept newline moved
+        end_pos.line += token_store_pos(store, first + total_new).line - resync_line;
+    }
+
+    // Brackets are done again from the start of the new tokens
+    lex_relex_reopen_brackets(lex_process, start, outermost);
+    total_tokens = token_store_count(store);
+    for (int i = first; i < total_tokens; i++)
+    {
+        if (token_store_is_symbol(store, i, ')'))
+        {
+            // Where lex reports a stray one, just past it
+            compiler->pos = token_store_pos(store, i);
+            compiler->pos.col++;
+        }
+        lex_replay_brackets(lex_process, i);
+    }
+    for (int i = 0; i < vector_count(lex_process->open_brackets); i++)
+    {
+        int index = *(int *)vector_at(lex_process->open_brackets, i);
+        struct bracket_span *span = vector_at(lex_process->brackets, index);
+        span->end = end_offset;
+    }
+
+    lex_process->offset = end_offset;
+    lex_process->token_offset = end_offset;
+    lex_process->last_token_offset = total_tokens ? token_store_offset(store, total_tokens - 1) : 0;
+    vector_clear(lex_process->tokens);
+    if (total_tokens)
+    {
+        struct token newest;
+        token_store_token(store, total_tokens - 1, &newest);
+        token_vector_push(lex_process->tokens, newest);
+    }
+    lex_process->pos = end_pos;
+    compiler->pos = saved_pos;
+
+    edit->first_token = first;
+    edit->total_old_tokens = total_old;
+    edit->total_new_tokens = total_new;
+    return LEX_SUCCESS;
+}
@@ -0,0 +1,365 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/arena.h"
+#include "helpers/scan.h"
+#include "helpers/threadpool.h"
+
+/*
+ * Lexing one large input on several threads.
+ *
+ * A quick pre-scan that knows just enough about strings, character literals
+ * and comments picks newlines outside of them to split the input at. Every
+ * chunk is lexed on its own as if the input started there, and the chunks'
+ * token stores are then joined up in order: the bracket spans,
+ * current_expression_count and between_brackets are redone over the joined
+ * tokens, and lines are worked out from offsets like always.
+ *
+ * A chunk is only taken if the lexer stands right at its start after a
+ * newline token, and it ends with a newline token of its own. A chunk that
+ * doesn't fit, or failed to lex, is lexed again sequentially, and joining
+ * picks up again at the first split the sequential lexer stops right on. So
+ * the tokens always come out the same as lex would have made them, errors
+ * included.
+ */
+
+// Below this a chunk isn't worth a thread
+#define LEX_PARALLEL_MIN_CHUNK_SIZE (256 * 1024)
+
+struct lex_chunk
+{
+    // The input, and which part of it this chunk covers
+    const char *data;
+    size_t start;
+    size_t end;
+    size_t position;  // next character to read
+
+    // The chunk's own copy of the compile process, for its arena and jmp_buf
+    struct compile_process view;
+    struct lex_process *lex_process;
+    bool failed;
+};
+
+static char lex_chunk_next_char(struct lex_process *lex_process)
+{
+    struct lex_chunk *chunk = lex_process_private(lex_process);
+    if (chunk->position >= chunk->end)
+    {
+        return EOF;
+    }
+    return chunk->data[chunk->position++];
+}
+
+static char lex_chunk_peek_char(struct lex_process *lex_process)
+{
+    struct lex_chunk *chunk = lex_process_private(lex_process);
+    if (chunk->position >= chunk->end)
+    {
+        return EOF;
+    }
+    return chunk->data[chunk->position];
+}
+
+static void lex_chunk_push_char(struct lex_process *lex_process, char c)
+{
+    (void)c;
+    struct lex_chunk *chunk = lex_process_private(lex_process);
+    chunk->position--;
+}
+
+static const char *lex_chunk_input_span(struct lex_process *lex_process, size_t *len_out)
+{
+    struct lex_chunk *chunk = lex_process_private(lex_process);
+    *len_out = chunk->end - chunk->position;
+    return chunk->data + chunk->position;
+}
+
+static void lex_chunk_skip_chars(struct lex_process *lex_process, size_t amount)
+{
+    struct lex_chunk *chunk = lex_process_private(lex_process);
+    chunk->position += amount;
+}
+
+static struct lex_process_functions lex_chunk_functions =
+{
+    .next_char = lex_chunk_next_char,
+    .peek_char = lex_chunk_peek_char,
+    .push_char = lex_chunk_push_char,
+    .input_span = lex_chunk_input_span,
+    .skip_chars = lex_chunk_skip_chars,
+};
+
+// Splits at the first newline after every chunk_size bytes that isn't in a string, character literal or comment,
+// reading each of those the way the lexer does. Returns the number of chunks.
+static int lex_parallel_split(const char *data, size_t size, size_t chunk_size, size_t *starts, int max_chunks)
+{
+    int total_chunks = 1;
+    starts[0] = 0;
+    size_t next_split = chunk_size;
+    size_t i = 0;
+    while (i < size && total_chunks < max_chunks)
+    {
+        switch (data[i])
+        {
+        case '\n':
+            i++;
+            if (i >= next_split && i < size)
+            {
+                starts[total_chunks++] = i;
+                next_split = i + chunk_size;
+            }
+            break;
+
+        case '"':
+        {
+            // The lexer doesn't treat \" as an escape, the string ends at the next quote
+            const char *close = memchr(data + i + 1, '"', size - i - 1);
+            i = close ? (size_t)(close - data) + 1 : size;
+            break;
+        }
+
+        case '\'':
+            i += i + 1 < size && data[i + 1] == '\\' ? 4 : 3;
+            break;
+
+        case '/':
+            if (i + 1 < size && data[i + 1] == '/')
+            {
+                // Up to the newline, which ends the comment but isn't part of it
+                i += 2;
+                i += scan_find_newline(data + i, size - i);
+            }
+            else if (i + 1 < size && data[i + 1] == '*')
+            {
+                i += 2;
+                i += scan_find_comment_end(data + i, size - i) + 2;
+            }
+            else
+            {
+                i++;
+            }
+            break;
+
+        default:
+            i++;
+        }
+    }
+    return total_chunks;
+}
+
+static void lex_parallel_chunk_job(void *arg)
+{
+    struct lex_chunk *chunk = arg;
+    jmp_buf error_recovery;
+    if (setjmp(error_recovery))
+    {
+        chunk->failed = true;
+        return;
+    }
+    chunk->view.error_recovery = &error_recovery;
+
+    while (lex_step(chunk->lex_process))
+    {
+    }
+}
+
+// Whether the chunk's tokens are what the sequential lexer would make from where lex_process is now
+static bool lex_parallel_chunk_fits(struct lex_process *lex_process, struct lex_chunk *chunk, size_t base, bool last)
+{
+    if (chunk->failed || chunk->position != chunk->end || lex_process->offset != base + chunk->start)
+    {
+        return false;
+    }
+
+    // The chunk was lexed as if it started a fresh line
+    struct token *previous = token_vector_back_or_null(lex_process->tokens);
+    if (chunk->start > 0 && (!previous || previous->type != TOKEN_TYPE_NEWLINE))
+    {
+        return false;
+    }
+
+    // Otherwise the last token ran into the end of the chunk, the pre-scan split
+    // somewhere it shouldn't have. A string after include is one way.
+    struct token *last_token = token_vector_back_or_null(chunk->lex_process->tokens);
+    if (!last && (!last_token || last_token->type != TOKEN_TYPE_NEWLINE))
+    {
+        return false;
+    }
+
+    // A bracket closed that was never opened, the sequential lexer gives the error
+    int depth = lex_process->current_expression_count;
+    struct token_store *store = chunk->lex_process->token_store;
+    for (int i = 0; i < token_store_count(store); i++)
+    {
+        if (token_store_is_operator(store, i, OPERATOR_LEFT_PARENTHESIS))
+        {
+            depth++;
+        }
+        else if (token_store_is_symbol(store, i, ')') && --depth < 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void lex_parallel_join_chunk(struct lex_process *lex_process, struct lex_chunk *chunk)
+{
+    struct lex_process *chunk_lexer = chunk->lex_process;
+    struct token_store *store = lex_process->token_store;
+
+    // Whitespace at the start of the chunk follows the newline that ended the last one
+    char first = chunk->data[chunk->start];
+    struct token *last_token = token_vector_back_or_null(lex_process->tokens);
+    if (last_token && (first == ' ' || first == '\t'))
+    {
+        last_token->whitespace = true;
+        token_store_set_whitespace(store, token_store_count(store) - 1);
+    }
+
+    // Offsets are into the whole input already, only the brackets need redoing
+    int index = token_store_count(store);
+    token_store_replace(store, index, 0, chunk_lexer->token_store, 0);
+    for (int i = index; i < token_store_count(store); i++)
+    {
+        lex_replay_brackets(lex_process, i);
+    }
+
+    // The chunk's newest token is the one the lexer looks back at now
+    struct token *newest = token_vector_back_or_null(chunk_lexer->tokens);
+    if (newest)
+    {
+        vector_clear(lex_process->tokens);
+        token_vector_push(lex_process->tokens, *newest);
+        lex_process->last_token_offset = chunk_lexer->last_token_offset;
+    }
+
+    // Move the lexer on past the chunk, as if it had read it. The chunk started
+    // on line 1, and at column 1 like every line does.
+    int line_delta = lex_process->pos.line - 1;
+    size_t length = chunk->end - chunk->start;
+    lex_process->function->skip_chars(lex_process, length);
+    lex_process->offset = chunk_lexer->offset;
+    lex_process->pos = chunk_lexer->pos;
+    lex_process->pos.line += line_delta;
+}
+
+static void lex_parallel_free_chunks(struct compile_process *compiler, struct lex_chunk *chunks, int total_chunks)
+{
+    for (int i = 0; i < total_chunks; i++)
+    {
+        lex_process_free(chunks[i].lex_process);
+        // Comments the chunk lexed point into its arena
+        arena_adopt(compiler->arena, chunks[i].view.arena);
+    }
+    free(chunks);
+}
+
+static void lex_parallel_chunks(struct lex_process *lex_process, const char *data, size_t size, int total_threads, size_t chunk_size)
+{
+    if (chunk_size == 0)
+    {
+        chunk_size = size / total_threads + 1;
+        if (chunk_size < LEX_PARALLEL_MIN_CHUNK_SIZE)
+        {
+            chunk_size = LEX_PARALLEL_MIN_CHUNK_SIZE;
+        }
+    }
+
+    int max_chunks = size / chunk_size + 1;
+    size_t *starts = malloc((max_chunks + 1) * sizeof(size_t));
+    int total_chunks = lex_parallel_split(data, size, chunk_size, starts, max_chunks);
+    if (total_chunks < 2)
+    {
+        free(starts);
+        return;
+    }
+    starts[total_chunks] = size;
+
+    struct compile_process *compiler = lex_process->compiler;
+    struct lex_chunk *chunks = calloc(total_chunks, sizeof(struct lex_chunk));
+    struct threadpool *pool = threadpool_create(total_threads < total_chunks ? total_threads : total_chunks);
+    for (int i = 0; i < total_chunks; i++)
+    {
+        struct lex_chunk *chunk = &chunks[i];
+        chunk->data = data;
+        chunk->start = starts[i];
+        chunk->end = starts[i + 1];
+        chunk->position = chunk->start;
+
+        chunk->view = *compiler;
+        chunk->view.flags |= COMPILE_PROCESS_FLAG_SPECULATIVE;
+        chunk->view.arena = arena_create(ARENA_DEFAULT_CHUNK_SIZE);
+
+        chunk->lex_process = lex_process_create(&chunk->view, &lex_chunk_functions, chunk);
+        chunk->lex_process->flags |= LEX_PROCESS_FLAG_NO_BRACKETS;
+        token_store_reserve(chunk->lex_process->token_store, (chunk->end - chunk->start) / COMPILER_BYTES_PER_TOKEN_ESTIMATE);
+        lex_begin(chunk->lex_process);
+        chunk->lex_process->offset = lex_process->offset + chunk->start;
+        threadpool_submit(pool, lex_parallel_chunk_job, chunk);
+    }
+    threadpool_free(pool);
+
+    // An error the sequential lexer runs into must not lose the chunks
+    jmp_buf *outer_recovery = compiler->error_recovery;
+    jmp_buf error_recovery;
+    if (setjmp(error_recovery))
+    {
+        compiler->error_recovery = outer_recovery;
+        lex_parallel_free_chunks(compiler, chunks, total_chunks);
+        free(starts);
+        if (!outer_recovery)
+        {
+            exit(-1);
+        }
+        longjmp(*outer_recovery, 1);
+    }
+    compiler->error_recovery = &error_recovery;
+
+    size_t base = lex_process->offset;
+    for (int i = 0; i < total_chunks; i++)
+    {
+        struct lex_chunk *chunk = &chunks[i];
+        if (lex_parallel_chunk_fits(lex_process, chunk, base, i == total_chunks - 1))
+        {
+            lex_parallel_join_chunk(lex_process, chunk);
+            continue;
+        }
+
+        // Up to the next split, or past it when a token runs across
+        while (lex_process->offset < base + chunk->end && lex_step(lex_process))
+        {
+        }
+    }
+
+    compiler->error_recovery = outer_recovery;
+    lex_parallel_free_chunks(compiler, chunks, total_chunks);
+    free(starts);
+}
+
+int lex_parallel(struct lex_process *lex_process, int total_threads, size_t chunk_size)
+{
+    lex_begin(lex_process);
+
+    size_t size = 0;
+    const char *data = NULL;
+    if (lex_process->function->input_span && lex_process->function->skip_chars)
+    {
+        data = lex_process->function->input_span(lex_process, &size);
+    }
+
+    // Chunks are joined through the token store
+    if (data && total_threads > 1 && lex_process_keeps_token_store(lex_process) &&
+        token_store_count(lex_process->token_store) == 0)
+    {
+        lex_parallel_chunks(lex_process, data, size, total_threads, chunk_size);
+    }
+
+    // Whatever the chunks didn't cover
+    while (lex_step(lex_process))
+    {
+    }
+    return LEX_SUCCESS;
+}
@@ -2,6 +2,7 @@
 
 #include "compiler.h"
 #include "helpers/vector.h"
+#include "helpers/buffer.h"
 
 struct lex_process *lex_process_create(struct compile_process* compiler, struct lex_process_functions *functions, void *private)
 {
@@ -10,6 +11,10 @@ struct lex_process *lex_process_create(struct compile_process* compiler, struct
     process->function = functions;
     process->private = private;
     process->tokens = vector_create(sizeof(struct token));
+    process->buffer = buffer_create();
+    process->brackets = vector_create(sizeof(struct bracket_span));
+    process->open_brackets = vector_create(sizeof(int));
+    process->token_store = token_store_create(compiler->cfile.data, compiler->cfile.size, compiler->cfile.abs_path);
     process->pos.line = 1;
     process->pos.col = 1;
 
@@ -19,6 +24,10 @@ struct lex_process *lex_process_create(struct compile_process* compiler, struct
 void lex_process_free(struct lex_process *process)
 {
     vector_free(process->tokens);
+    buffer_free(process->buffer);
+    vector_free(process->brackets);
+    vector_free(process->open_brackets);
+    token_store_free(process->token_store);
     free(process);
 }
 
@@ -31,3 +40,8 @@ struct vector *lex_process_tokens(struct lex_process *process)
 {
     return process->tokens;
 }
+
+bool lex_process_keeps_token_store(struct lex_process *process)
+{
+    return !(process->flags & LEX_PROCESS_FLAG_NO_TOKEN_STORE);
+}
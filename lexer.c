@@ -2,33 +2,32 @@
 #include <assert.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <limits.h>
 
 #include "compiler.h"
 #include "helpers/vector.h"
 #include "helpers/buffer.h"
+#include "helpers/arena.h"
+#include "helpers/scan.h"
 
-#define LEX_GETC_IF(buffer, c, exp)     \
-    for (c = peekc(); exp; c = peekc()) \
-    {                                   \
-        buffer_write(buffer, c);        \
-        nextc();                        \
+#define LEX_GETC_IF(buffer, c, exp)                            \
+    for (c = peekc(lex_process); exp; c = peekc(lex_process)) \
+    {                                                          \
+        buffer_write(buffer, c);                               \
+        nextc(lex_process);                                    \
     }
 
-static struct lex_process *lex_process;
-static struct token temp_token;
-
-static char peekc()
+static char peekc(struct lex_process *lex_process)
 {
     return lex_process->function->peek_char(lex_process);
 }
 
-static char nextc()
+static char nextc(struct lex_process *lex_process)
 {
     char c = lex_process->function->next_char(lex_process);
-
-    if (lex_is_in_expression())
+    if (c != EOF)
     {
-        buffer_write(lex_process->parentheses_buffer, c);
+        lex_process->offset++;
     }
 
     lex_process->pos.col++;
@@ -40,64 +39,126 @@ static char nextc()
     return c;
 }
 
-static void pushc(char c)
+static void pushc(struct lex_process *lex_process, char c)
 {
     lex_process->function->push_char(lex_process, c);
+    lex_process->offset--;
 }
 
-static char assert_next_c(char c)
+// Returns the rest of the input when it sits in one block of memory, NULL otherwise.
+static const char *lex_input_span(struct lex_process *lex_process, size_t *len_out)
 {
-    char next_c = nextc();
+    if (!lex_process->function->input_span)
+    {
+        return NULL;
+    }
+    return lex_process->function->input_span(lex_process, len_out);
+}
+
+// Same as calling nextc amount times on the span lex_input_span returned.
+static void skipc(struct lex_process *lex_process, const char *span, size_t amount)
+{
+    lex_process->function->skip_chars(lex_process, amount);
+    lex_process->offset += amount;
+    pos_advance(&lex_process->pos, span, amount);
+}
+
+static char assert_next_c(struct lex_process *lex_process, char c)
+{
+    char next_c = nextc(lex_process);
     assert(next_c == c);
     return next_c;
 }
 
-static struct pos lex_file_position()
+// The returned buffer is only valid until the next token is read.
+static struct buffer *lex_scratch_buffer(struct lex_process *lex_process)
+{
+    struct buffer *buffer = lex_process->buffer;
+    buffer->len = 0;
+    return buffer;
+}
+
+static struct pos lex_file_position(struct lex_process *lex_process)
 {
     return lex_process->pos;
 }
 
-struct token *token_create(struct token *_token)
+static uint32_t lex_between_brackets(struct lex_process *lex_process)
 {
-    memcpy(&temp_token, _token, sizeof(struct token));
-    temp_token.pos = lex_file_position();
-    if (lex_is_in_expression())
+    if (!lex_is_in_expression(lex_process))
     {
-        temp_token.between_brackets = buffer_ptr(lex_process->parentheses_buffer);
+        return 0;
     }
-    return &temp_token;
+
+    int outermost = *(int *)vector_at(lex_process->open_brackets, 0);
+    struct bracket_span *span = vector_at(lex_process->brackets, outermost);
+    return span->start + 1;
+}
+
+struct token *token_create(struct lex_process *lex_process, struct token *_token)
+{
+    struct token *token = &lex_process->temp_token;
+    memcpy(token, _token, sizeof(struct token));
+    token->pos = lex_file_position(lex_process);
+    token->between_brackets = lex_between_brackets(lex_process);
+    return token;
 }
 
-static struct token *lexer_last_token()
+static struct token *lexer_last_token(struct lex_process *lex_process)
 {
     return vector_back_or_null(lex_process->tokens);
 }
 
-static struct token *handle_white_space()
+static struct token *handle_white_space(struct lex_process *lex_process)
 {
-    struct token *last_token = lexer_last_token();
+    struct token *last_token = lexer_last_token(lex_process);
     if (last_token)
     {
         last_token->whitespace = true;
+        if (lex_process_keeps_token_store(lex_process))
+        {
+            token_store_set_whitespace(lex_process->token_store, token_store_count(lex_process->token_store) - 1);
+        }
     }
-    nextc();
-    return read_next_token();
+    nextc(lex_process);
+    return read_next_token(lex_process);
 }
 
-const char *read_number_str(void)
+// The returned string lives in the lexer's scratch buffer, use it before reading another token.
+const char *read_number_str(struct lex_process *lex_process)
 {
-    // const char *num = NULL;
-    struct buffer *buffer = buffer_create();
-    char c = peekc();
+    struct buffer *buffer = lex_scratch_buffer(lex_process);
+    char c = peekc(lex_process);
     LEX_GETC_IF(buffer, c, c >= '0' && c <= '9');
 
     buffer_write(buffer, '\0');
     return buffer_ptr(buffer);
 }
 
-unsigned long long read_number()
+unsigned long long read_number(struct lex_process *lex_process)
 {
-    const char *s = read_number_str();
+    size_t len = 0;
+    const char *span = lex_input_span(lex_process, &len);
+    if (span)
+    {
+        size_t total_digits = scan_digit_run(span, len);
+        unsigned long long number = 0;
+        for (size_t i = 0; i < total_digits; i++)
+        {
+            int digit = span[i] - '0';
+            if (number > ((unsigned long long)LLONG_MAX - digit) / 10)
+            {
+                // Saturate like atoll does
+                number = LLONG_MAX;
+                continue;
+            }
+            number = number * 10 + digit;
+        }
+        skipc(lex_process, span, total_digits);
+        return number;
+    }
+
+    const char *s = read_number_str(lex_process);
     return atoll(s);
 }
 
@@ -114,15 +175,15 @@ int lexer_number_type(char c)
     return NUMBER_TYPE_NORMAL;
 }
 
-struct token *token_make_number_for_value(unsigned long number)
+struct token *token_make_number_for_value(struct lex_process *lex_process, unsigned long number)
 {
-    int number_type = lexer_number_type(peekc());
+    int number_type = lexer_number_type(peekc(lex_process));
 
     if (number_type != NUMBER_TYPE_NORMAL)
     {
-        nextc(); // pop off the trailing character
+        nextc(lex_process); // pop off the trailing character
     }
-    return token_create(&(struct token){
+    return token_create(lex_process, &(struct token){
         .type = TOKEN_TYPE_NUMBER,
         .llnum = number,
         .num = {
@@ -131,17 +192,17 @@ struct token *token_make_number_for_value(unsigned long number)
     });
 }
 
-struct token *token_make_number()
+struct token *token_make_number(struct lex_process *lex_process)
 {
-    return token_make_number_for_value(read_number());
+    return token_make_number_for_value(lex_process, read_number(lex_process));
 }
 
-struct token *token_make_string(char start_delm, char end_delim)
+struct token *token_make_string(struct lex_process *lex_process, char start_delm, char end_delim)
 {
-    struct buffer *buffer = buffer_create();
-    assert(nextc() == start_delm);
-    char c = nextc();
-    for (; c != end_delim && c != EOF; c = nextc())
+    struct buffer *buffer = lex_scratch_buffer(lex_process);
+    assert(nextc(lex_process) == start_delm);
+    char c = nextc(lex_process);
+    for (; c != end_delim && c != EOF; c = nextc(lex_process))
     {
         if (c == '\\')
         {
@@ -149,10 +210,10 @@ struct token *token_make_string(char start_delm, char end_delim)
         }
         buffer_write(buffer, c);
     }
-    buffer_write(buffer, '\0');
-    return token_create(&(struct token){
+    const char *str = intern_string(lex_process->compiler->intern_pool, buffer_ptr(buffer), buffer->len);
+    return token_create(lex_process, &(struct token){
         .type = TOKEN_TYPE_STRING,
-        .sval = buffer_ptr(buffer),
+        .sval = str,
     });
 }
 
@@ -161,205 +222,135 @@ static bool op_treated_as_one(char op)
     return op == '(' || op == '[' || op == ',' || op == '.' || op == '*' || op == '?';
 }
 
-static bool is_single_operator(char op)
-{
-    return op == '+' || op == '-' || op == '=' || op == '<' || op == '>' || op == '!' || op == '&' || op == '|' || op == '^' || op == '~' || op == '*' || op == '/' || op == '%' || op == '(' || op == '[' || op == ',' || op == '.' || op == '?';
-}
-
-static bool op_is_valid(const char *op)
-{
-    return S_EQ(op, "+") ||
-           S_EQ(op, "-") ||
-           S_EQ(op, "=") ||
-           S_EQ(op, "<") ||
-           S_EQ(op, ">") ||
-           S_EQ(op, "!") ||
-           S_EQ(op, "&") ||
-           S_EQ(op, "|") ||
-           S_EQ(op, "^") ||
-           S_EQ(op, "~") ||
-           S_EQ(op, "*") ||
-           S_EQ(op, "/") ||
-           S_EQ(op, "%") ||
-           S_EQ(op, "(") ||
-           S_EQ(op, "[") ||
-           S_EQ(op, ",") ||
-           S_EQ(op, ".") ||
-           S_EQ(op, "?") ||
-           S_EQ(op, "++") ||
-           S_EQ(op, "--") ||
-           S_EQ(op, "+=") ||
-           S_EQ(op, "-=") ||
-           S_EQ(op, "*=") ||
-           S_EQ(op, "/=") ||
-           S_EQ(op, "%=") ||
-           S_EQ(op, "==") ||
-           S_EQ(op, "!=") ||
-           S_EQ(op, "<=") ||
-           S_EQ(op, ">=") ||
-           S_EQ(op, "&&") ||
-           S_EQ(op, "||") ||
-           S_EQ(op, "...") ||
-           S_EQ(op, "<<") ||
-           S_EQ(op, ">>");
-}
-
-void read_op_flush_back_keep_first(struct buffer *buffer)
-{
-    const char *data = buffer_ptr(buffer);
-    int len = buffer->len;
-    for (int i = len - 1; i >= 1; i--)
-    {
-        if (data[i] == '\0')
-        {
-            continue;
-        }
-        pushc(data[i]);
-    }
-}
-
-const char *read_op()
+// Returns the OPERATOR_* id of the operator at the current position.
+int read_op(struct lex_process *lex_process)
 {
-    bool single_operator = true;
-    char op = nextc();
-    struct buffer *buffer = buffer_create();
-    buffer_write(buffer, op);
+    char op[2] = {nextc(lex_process), 0};
 
     // If op can be a multi-character operator.
-    if (!op_treated_as_one(op))
+    if (!op_treated_as_one(op[0]))
     {
-        op = peekc();
-        if (is_single_operator(op))
+        op[1] = peekc(lex_process);
+        int id = operator_lookup(op, 2);
+        if (id != OPERATOR_NONE && operator_has_flag(id, OPERATOR_FLAG_LEXED))
         {
-            buffer_write(buffer, op);
-            nextc();
-            single_operator = false;
+            nextc(lex_process);
+            return id;
         }
     }
 
-    buffer_write(buffer, '\0');
-    char *ptr = buffer_ptr(buffer);
-    if (!single_operator)
-    {
-        if (!op_is_valid(ptr))
-        {
-            read_op_flush_back_keep_first(buffer);
-            ptr[1] = '\0';
-        }
-    }
-    else if (!op_is_valid(ptr))
+    int id = operator_lookup(op, 1);
+    if (id == OPERATOR_NONE || !operator_has_flag(id, OPERATOR_FLAG_LEXED))
     {
-        compiler_error(lex_process->compiler, "Invalid operator '%s'", ptr);
+        compiler_error(lex_process->compiler, "Invalid operator '%c'", op[0]);
     }
-    return ptr;
+    return id;
 }
 
-static void lex_new_expression()
+static void lex_new_expression(struct lex_process *lex_process)
 {
-    lex_process->current_expression_count++;
-    if (lex_process->current_expression_count == 1)
+    if (lex_process->flags & LEX_PROCESS_FLAG_NO_BRACKETS)
     {
-        lex_process->parentheses_buffer = buffer_create();
+        return;
     }
+
+    lex_process->current_expression_count++;
+
+    // Brackets are recorded as they open, so the table ends up ordered by start
+    struct bracket_span span = {.start = lex_process->token_offset, .end = UINT32_MAX};
+    int index = vector_count(lex_process->brackets);
+    vector_push(lex_process->brackets, &span);
+    vector_push(lex_process->open_brackets, &index);
 }
 
-static void lex_finish_expression()
+static void lex_finish_expression(struct lex_process *lex_process)
 {
+    if (lex_process->flags & LEX_PROCESS_FLAG_NO_BRACKETS)
+    {
+        return;
+    }
+
     lex_process->current_expression_count--;
     if (lex_process->current_expression_count < 0)
     {
         compiler_error(lex_process->compiler, "Unexpected closing bracket");
     }
+
+    int index = *(int *)vector_back(lex_process->open_brackets);
+    vector_pop(lex_process->open_brackets);
+    struct bracket_span *span = vector_at(lex_process->brackets, index);
+    span->end = lex_process->offset - 1;
 }
 
-bool lex_is_in_expression()
+bool lex_is_in_expression(struct lex_process *lex_process)
 {
     return lex_process->current_expression_count > 0;
 }
 
+void lex_replay_brackets(struct lex_process *lex_process, int index)
+{
+    // In the order token_make_symbol and token_make_operator_or_string do it
+    struct token_store *store = lex_process->token_store;
+    uint32_t offset = token_store_offset(store, index);
+    lex_process->token_offset = offset;
+    lex_process->offset = offset + 1;
+    if (token_store_is_symbol(store, index, ')'))
+    {
+        lex_finish_expression(lex_process);
+    }
+
+    token_store_set_between_brackets(store, index, lex_between_brackets(lex_process));
+    if (token_store_is_operator(store, index, OPERATOR_LEFT_PARENTHESIS))
+    {
+        lex_new_expression(lex_process);
+    }
+}
+
 bool keyword_is_datatype(const char *str)
 {
-    return S_EQ(str, "char") ||
-           S_EQ(str, "short") ||
-           S_EQ(str, "int") ||
-           S_EQ(str, "long") ||
-           S_EQ(str, "float") ||
-           S_EQ(str, "double") ||
-           S_EQ(str, "void") ||
-           S_EQ(str, "struct") ||
-           S_EQ(str, "union") ||
-           S_EQ(str, "enum");
+    return str && keyword_has_flag(keyword_lookup(str, strlen(str)), KEYWORD_FLAG_DATATYPE);
 }
 
 bool is_keyword(const char *str)
 {
-    return S_EQ(str, "unsigned") ||
-           S_EQ(str, "signed") ||
-           S_EQ(str, "char") ||
-           S_EQ(str, "short") ||
-           S_EQ(str, "int") ||
-           S_EQ(str, "long") ||
-           S_EQ(str, "float") ||
-           S_EQ(str, "double") ||
-           S_EQ(str, "void") ||
-           S_EQ(str, "struct") ||
-           S_EQ(str, "union") ||
-           S_EQ(str, "enum") ||
-           S_EQ(str, "const") ||
-           S_EQ(str, "__ignore_typecheck__") ||
-           S_EQ(str, "static") ||
-           S_EQ(str, "typedef") ||
-           S_EQ(str, "sizeof") ||
-           S_EQ(str, "if") ||
-           S_EQ(str, "else") ||
-           S_EQ(str, "switch") ||
-           S_EQ(str, "case") ||
-           S_EQ(str, "default") ||
-           S_EQ(str, "while") ||
-           S_EQ(str, "do") ||
-           S_EQ(str, "for") ||
-           S_EQ(str, "goto") ||
-           S_EQ(str, "continue") ||
-           S_EQ(str, "break") ||
-           S_EQ(str, "return") ||
-           S_EQ(str, "extern") ||
-           S_EQ(str, "restrict") ||
-           S_EQ(str, "include");
-}
-
-static struct token *token_make_operator_or_string()
-{
-    char op = peekc();
+    return str && keyword_lookup(str, strlen(str)) != KEYWORD_NONE;
+}
+
+static struct token *token_make_operator_or_string(struct lex_process *lex_process)
+{
+    char op = peekc(lex_process);
     if (op == '<') // in case of #include <abc.h>
     {
-        struct token *last_token = lexer_last_token();
-        if (token_is_keyword(last_token, "include"))
+        struct token *last_token = lexer_last_token(lex_process);
+        if (token_is_keyword_id(last_token, KEYWORD_INCLUDE))
         {
-            return token_make_string('<', '>');
+            return token_make_string(lex_process, '<', '>');
         }
     }
 
-    struct token *token = token_create(&(struct token){
+    int id = read_op(lex_process);
+    struct token *token = token_create(lex_process, &(struct token){
         .type = TOKEN_TYPE_OPERATOR,
-        .sval = read_op(),
+        .sval = operator_atom(id),
+        .op = id,
     });
 
     if (op == '(')
     {
-        lex_new_expression();
+        lex_new_expression(lex_process);
     }
     return token;
 }
 
-static struct token *token_make_symbol()
+static struct token *token_make_symbol(struct lex_process *lex_process)
 {
-    char c = nextc();
+    char c = nextc(lex_process);
     if (c == ')')
     {
-        lex_finish_expression();
+        lex_finish_expression(lex_process);
     }
 
-    struct token *token = token_create(&(struct token){
+    struct token *token = token_create(lex_process, &(struct token){
         .type = TOKEN_TYPE_SYMBOL,
         .cval = c,
     });
@@ -367,64 +358,134 @@ static struct token *token_make_symbol()
     return token;
 }
 
-static struct token *token_make_newline()
+static struct token *token_make_newline(struct lex_process *lex_process)
 {
-    nextc();
-    return token_create(&(struct token){
+    nextc(lex_process);
+    return token_create(lex_process, &(struct token){
         .type = TOKEN_TYPE_NEWLINE,
     });
 }
 
-static struct token *token_make_identifier_or_keyword()
+static struct token *token_make_identifier_or_keyword(struct lex_process *lex_process)
 {
-    struct buffer *buffer = buffer_create();
-    char c = peekc();
-    LEX_GETC_IF(buffer, c, (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '1' && c <= '9') || c == '_');
-
-    buffer_write(buffer, '\0');
-    char *str = buffer_ptr(buffer);
+    const char *str = NULL;
+    size_t len = 0;
+    const char *span = lex_input_span(lex_process, &len);
+    if (span)
+    {
+        // Intern straight out of the input, no copy
+        len = scan_identifier_run(span, len);
+        str = intern_string(lex_process->compiler->intern_pool, span, len);
+        skipc(lex_process, span, len);
+    }
+    else
+    {
+        struct buffer *buffer = lex_scratch_buffer(lex_process);
+        char c = peekc(lex_process);
+        LEX_GETC_IF(buffer, c, (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '1' && c <= '9') || c == '_');
+        len = buffer->len;
+        str = intern_string(lex_process->compiler->intern_pool, buffer_ptr(buffer), len);
+    }
 
-    // Check if this is a keyword
-    if (is_keyword(str))
+    // Check if this is a keyword, reusing the hash the intern pool already computed
+    int keyword = keyword_lookup_hashed(str, len, intern_hash(str));
+    if (keyword != KEYWORD_NONE)
     {
-        return token_create(&(struct token){
+        return token_create(lex_process, &(struct token){
             .type = TOKEN_TYPE_KEYWORD,
             .sval = str,
+            .keyword = keyword,
         });
     }
 
-    return token_create(&(struct token){
+    return token_create(lex_process, &(struct token){
         .type = TOKEN_TYPE_IDENTIFIER,
         .sval = str,
     });
 }
 
-struct token *token_read_special_token()
+struct token *token_read_special_token(struct lex_process *lex_process)
 {
-    char c = peekc();
+    char c = peekc(lex_process);
     if (isalpha(c) || c == '_')
     {
-        return token_make_identifier_or_keyword();
+        return token_make_identifier_or_keyword(lex_process);
     }
     return NULL;
 }
 
-struct token *token_make_one_line_comment()
+struct token *token_make_one_line_comment(struct lex_process *lex_process)
 {
-    struct buffer *buffer = buffer_create();
+    size_t len = 0;
+    const char *span = lex_input_span(lex_process, &len);
+    if (span)
+    {
+        len = scan_find_newline(span, len);
+        skipc(lex_process, span, len);
+        return token_create(lex_process, &(struct token){
+            .type = TOKEN_TYPE_COMMENT,
+            .sval = arena_strndup(lex_process->compiler->arena, span, len),
+        });
+    }
+
+    struct buffer *buffer = lex_scratch_buffer(lex_process);
     char c = 0;
     LEX_GETC_IF(buffer, c, c != '\n' && c != EOF);
 
-    buffer_write(buffer, '\0');
-    return token_create(&(struct token){
+    return token_create(lex_process, &(struct token){
         .type = TOKEN_TYPE_COMMENT,
-        .sval = buffer_ptr(buffer),
+        .sval = arena_strndup(lex_process->compiler->arena, buffer_ptr(buffer), buffer->len),
     });
 }
 
-struct token *token_make_multiline_comment()
+// The comment text leaves out every star, as the character at a time version does.
+static struct token *token_make_multiline_comment_from_span(struct lex_process *lex_process, const char *span, size_t len)
 {
-    struct buffer *buffer = buffer_create();
+    size_t end = scan_find_comment_end(span, len);
+    if (end == len || span[end] == (char)0xff)
+    {
+        // Up to where the character at a time version stops, a 0xff byte reads as EOF there
+        skipc(lex_process, span, end);
+        compiler_error(lex_process->compiler, "Unexpected end of file");
+    }
+
+    const char *text = NULL;
+    if (!memchr(span, '*', end))
+    {
+        text = arena_strndup(lex_process->compiler->arena, span, end);
+    }
+    else
+    {
+        char *stripped = arena_alloc(lex_process->compiler->arena, end + 1);
+        size_t stripped_len = 0;
+        for (size_t i = 0; i < end; i++)
+        {
+            if (span[i] != '*')
+            {
+                stripped[stripped_len++] = span[i];
+            }
+        }
+        stripped[stripped_len] = '\0';
+        text = stripped;
+    }
+
+    skipc(lex_process, span, end + 2);
+    return token_create(lex_process, &(struct token){
+        .type = TOKEN_TYPE_COMMENT,
+        .sval = text,
+    });
+}
+
+struct token *token_make_multiline_comment(struct lex_process *lex_process)
+{
+    size_t len = 0;
+    const char *span = lex_input_span(lex_process, &len);
+    if (span)
+    {
+        return token_make_multiline_comment_from_span(lex_process, span, len);
+    }
+
+    struct buffer *buffer = lex_scratch_buffer(lex_process);
     char c = 0;
 
     while (1)
@@ -436,44 +497,43 @@ struct token *token_make_multiline_comment()
         }
         else if (c == '*')
         {
-            nextc();
-            c = peekc();
+            nextc(lex_process);
+            c = peekc(lex_process);
             if (c == '/')
             {
-                nextc();
+                nextc(lex_process);
                 break;
             }
         }
     }
 
-    buffer_write(buffer, '\0');
-    return token_create(&(struct token){
+    return token_create(lex_process, &(struct token){
         .type = TOKEN_TYPE_COMMENT,
-        .sval = buffer_ptr(buffer),
+        .sval = arena_strndup(lex_process->compiler->arena, buffer_ptr(buffer), buffer->len),
     });
 }
 
-struct token *handle_comment()
+struct token *handle_comment(struct lex_process *lex_process)
 {
-    char c = peekc();
+    char c = peekc(lex_process);
     if (c == '/')
     {
-        nextc();
-        if (peekc() == '/')
+        nextc(lex_process);
+        if (peekc(lex_process) == '/')
         {
-            nextc();
-            return token_make_one_line_comment();
+            nextc(lex_process);
+            return token_make_one_line_comment(lex_process);
         }
-        else if (peekc() == '*')
+        else if (peekc(lex_process) == '*')
         {
-            nextc();
-            return token_make_multiline_comment();
+            nextc(lex_process);
+            return token_make_multiline_comment(lex_process);
         }
         else
         {
             // This is a division operator.
-            pushc('/');
-            return token_make_operator_or_string();
+            pushc(lex_process, '/');
+            return token_make_operator_or_string(lex_process);
         }
     }
     return NULL;
@@ -496,26 +556,30 @@ char lex_get_escaped_char(char c)
     }
 }
 
-void lex_pop_token()
+void lex_pop_token(struct lex_process *lex_process)
 {
     vector_pop(lex_process->tokens);
+    if (lex_process_keeps_token_store(lex_process))
+    {
+        token_store_pop(lex_process->token_store);
+    }
 }
 
-struct token *token_make_special_number_hexadecimal()
+struct token *token_make_special_number_hexadecimal(struct lex_process *lex_process)
 {
     // Skip the x
-    nextc();
+    nextc(lex_process);
 
-    struct buffer *buffer = buffer_create();
-    char c = peekc();
+    struct buffer *buffer = lex_scratch_buffer(lex_process);
+    char c = peekc(lex_process);
     c = tolower(c);
     LEX_GETC_IF(buffer, c, (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'));
     buffer_write(buffer, '\0');
     unsigned long number = strtol(buffer_ptr(buffer), 0, 16);
-    return token_make_number_for_value(number);
+    return token_make_number_for_value(lex_process, number);
 }
 
-void lex_validate_binary_string(char *str)
+void lex_validate_binary_string(struct lex_process *lex_process, char *str)
 {
     for (int i = 0; str[i] != '\0'; i++)
     {
@@ -526,42 +590,44 @@ void lex_validate_binary_string(char *str)
     }
 }
 
-struct token *token_make_special_number_binary()
+struct token *token_make_special_number_binary(struct lex_process *lex_process)
 {
     // Skip the b
-    nextc();
+    nextc(lex_process);
 
-    struct buffer *buffer = buffer_create();
-    char c = peekc();
+    struct buffer *buffer = lex_scratch_buffer(lex_process);
+    char c = peekc(lex_process);
     c = tolower(c);
     LEX_GETC_IF(buffer, c, (c >= '0' && c <= '1'));
     buffer_write(buffer, '\0');
-    lex_validate_binary_string(buffer_ptr(buffer));
+    lex_validate_binary_string(lex_process, buffer_ptr(buffer));
     unsigned long number = strtol(buffer_ptr(buffer), 0, 2);
-    return token_make_number_for_value(number);
+    return token_make_number_for_value(lex_process, number);
 }
 
-struct token *token_make_special_number()
+struct token *token_make_special_number(struct lex_process *lex_process)
 {
     struct token* token = NULL;
-    struct token *last_token = lexer_last_token();
+    struct token *last_token = lexer_last_token(lex_process);
 
     // In case this is actually an identifier or keyword that starts with x or b;
     if (!last_token || !(last_token->type == TOKEN_TYPE_NUMBER && last_token->llnum == 0))
     {
-        return token_make_identifier_or_keyword();
+        return token_make_identifier_or_keyword(lex_process);
     }
 
-    lex_pop_token();  // We don't want to make a token for the first 0 in 0x1234
+    // We don't want to make a token for the first 0 in 0x1234, the number starts where it did
+    lex_process->token_offset = lex_process->last_token_offset;
+    lex_pop_token(lex_process);
 
-    char c = peekc();
+    char c = peekc(lex_process);
     if (c == 'x')
     {
-        token = token_make_special_number_hexadecimal();
+        token = token_make_special_number_hexadecimal(lex_process);
     }
     else if (c == 'b')
     {
-        token = token_make_special_number_binary();
+        token = token_make_special_number_binary(lex_process);
     }
     // TODO: handle other special numbers
 
@@ -573,34 +639,35 @@ struct token *token_make_special_number()
     return token;
 }
 
-struct token *token_make_quote()
+struct token *token_make_quote(struct lex_process *lex_process)
 {
-    assert_next_c('\'');
-    char c = nextc();
+    assert_next_c(lex_process, '\'');
+    char c = nextc(lex_process);
     if (c == '\\')
     {
         // In case of an escaped character in quotes like '\n'
-        c = nextc();
+        c = nextc(lex_process);
         c = lex_get_escaped_char(c);
     }
     
-    if (nextc() != '\'')
+    if (nextc(lex_process) != '\'')
     {
         compiler_error(lex_process->compiler, "You open with a quote, but did not close with a ' character.");
     }
 
-    return token_create(&(struct token){
+    return token_create(lex_process, &(struct token){
         .type = TOKEN_TYPE_NUMBER,
         .cval = c,
     });
 }
 
-struct token *read_next_token()
+struct token *read_next_token(struct lex_process *lex_process)
 {
     struct token *token = NULL;
-    char c = peekc();
+    lex_process->token_offset = lex_process->offset;
+    char c = peekc(lex_process);
 
-    token = handle_comment();
+    token = handle_comment(lex_process);
     if (token)
     {
         return token;
@@ -609,43 +676,43 @@ struct token *read_next_token()
     switch (c)
     {
     NUMERIC_CASE:
-        token = token_make_number();
+        token = token_make_number(lex_process);
         break;
 
     OPERATOR_CASE_EXCLUDE_DIVIDION:
-        token = token_make_operator_or_string();
+        token = token_make_operator_or_string(lex_process);
         break;
 
     SYMBOL_CASE:
-        token = token_make_symbol();
+        token = token_make_symbol(lex_process);
         break;
 
     case 'x':
     case 'b':
-        token = token_make_special_number();
+        token = token_make_special_number(lex_process);
         break;
 
     case '"':
-        token = token_make_string('"', '"');
+        token = token_make_string(lex_process, '"', '"');
         break;
 
     case '\'':
-        token = token_make_quote();
+        token = token_make_quote(lex_process);
         break;
 
     case ' ':
     case '\t':
-        token = handle_white_space();
+        token = handle_white_space(lex_process);
         break;
 
     case '\n':
-        token = token_make_newline();
+        token = token_make_newline(lex_process);
         break;
 
     case EOF:
         return NULL;
     default:
-        token = token_read_special_token();
+        token = token_read_special_token(lex_process);
         if (!token)
         {
             compiler_error(lex_process->compiler, "Unexpected character '%c'", c);
@@ -655,19 +722,89 @@ struct token *read_next_token()
     return token;
 }
 
-int lex(struct lex_process *process)
+void lex_begin(struct lex_process *lex_process)
 {
-    process->current_expression_count = 0;
-    process->parentheses_buffer = NULL;
+    lex_process->current_expression_count = 0;
+    lex_process->pos.filename = lex_process->compiler->cfile.abs_path;
+}
 
-    lex_process = process;
-    process->pos.filename = process->compiler->cfile.abs_path;
+static void lex_finish(struct lex_process *lex_process)
+{
+    // Brackets still open at the end of the input run to the end of it
+    for (int i = 0; i < vector_count(lex_process->open_brackets); i++)
+    {
+        int index = *(int *)vector_at(lex_process->open_brackets, i);
+        struct bracket_span *span = vector_at(lex_process->brackets, index);
+        span->end = lex_process->offset;
+    }
+    lex_process->finished = true;
+}
 
-    struct token *token = read_next_token();
-    while (token)
+bool lex_step(struct lex_process *lex_process)
+{
+    if (lex_process->finished)
+    {
+        return false;
+    }
+
+    struct token *token = read_next_token(lex_process);
+    if (!token)
+    {
+        lex_finish(lex_process);
+        return false;
+    }
+
+    if (lex_process_keeps_token_store(lex_process))
+    {
+        // The store has them all, tokens keeps the newest for the lexer to look back at
+        token_store_push(lex_process->token_store, token, lex_process->token_offset);
+        vector_clear(lex_process->tokens);
+    }
+    vector_push(lex_process->tokens, token);
+    lex_process->last_token_offset = lex_process->token_offset;
+    return true;
+}
+
+bool lex_next_token(struct lex_process *lex_process, struct token *token_out, uint32_t *offset_out)
+{
+    // The newest token stays in tokens until the one after it is read, it may
+    // still be marked as followed by whitespace or folded into a special number
+    struct vector *staged = lex_process->tokens;
+    uint32_t first_offset = lex_process->last_token_offset;
+    while (vector_count(staged) < 2)
+    {
+        if (vector_count(staged) == 1)
+        {
+            first_offset = lex_process->last_token_offset;
+        }
+
+        if (!lex_step(lex_process))
+        {
+            break;
+        }
+    }
+
+    int total_staged = vector_count(staged);
+    if (total_staged == 0)
+    {
+        return false;
+    }
+
+    *token_out = *token_vector_at(staged, 0);
+    *offset_out = first_offset;
+    if (total_staged == 2)
+    {
+        *token_vector_at(staged, 0) = *token_vector_at(staged, 1);
+    }
+    vector_pop(staged);
+    return true;
+}
+
+int lex(struct lex_process *lex_process)
+{
+    lex_begin(lex_process);
+    while (lex_step(lex_process))
     {
-        vector_push(process->tokens, token);
-        token = read_next_token();
     }
 
     return 0;
@@ -1,10 +1,12 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "compiler.h"
 
-int main(void)
+static int compile_single_file(const char *filename, const char *out_filename)
 {
-    int response = compile_file("./test.c", "./test.o", 0);
+    int response = compile_file(filename, out_filename, 0);
 
     if (response == COMPILER_FILE_COMPILE_FAILED)
     {
@@ -23,3 +25,106 @@ int main(void)
 
     return 0;
 }
+
+static void print_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-j threads] [--max-expression-depth depth] [--stream-tokens] [--pipeline] [--lex-threads threads] [--token-cache dir] [--cache dir] [--cache-max-size megabytes] file.c... [@response_file]...\n", program);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        return compile_single_file("./test.c", "./test.o");
+    }
+
+    int total_threads = 0;
+    struct batch *batch = batch_create(0, 0);
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        if (S_EQ(arg, "-j"))
+        {
+            if (i + 1 >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            total_threads = atoi(argv[++i]);
+        }
+        else if (S_EQ(arg, "--max-expression-depth"))
+        {
+            if (i + 1 >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            batch->options.max_expression_depth = atoi(argv[++i]);
+        }
+        else if (S_EQ(arg, "--lex-threads"))
+        {
+            if (i + 1 >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            batch->options.lex_threads = atoi(argv[++i]);
+        }
+        else if (S_EQ(arg, "--token-cache"))
+        {
+            if (i + 1 >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            batch->options.token_cache_dir = argv[++i];
+        }
+        else if (S_EQ(arg, "--cache"))
+        {
+            if (i + 1 >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            batch->options.compile_cache_dir = argv[++i];
+        }
+        else if (S_EQ(arg, "--cache-max-size"))
+        {
+            if (i + 1 >= argc)
+            {
+                print_usage(argv[0]);
+                return 1;
+            }
+            batch->options.compile_cache_max_size = (size_t)atoi(argv[++i]) * 1024 * 1024;
+        }
+        else if (S_EQ(arg, "--stream-tokens"))
+        {
+            batch->flags |= COMPILE_PROCESS_FLAG_STREAM_TOKENS;
+        }
+        else if (S_EQ(arg, "--pipeline"))
+        {
+            batch->flags |= COMPILE_PROCESS_FLAG_PIPELINE;
+        }
+        else if (arg[0] == '@')
+        {
+            if (batch_add_response_file(batch, arg + 1) != 0)
+            {
+                return 1;
+            }
+        }
+        else if (batch_add_file(batch, arg) != 0)
+        {
+            return 1;
+        }
+    }
+
+    if (total_threads > 0)
+    {
+        batch->total_threads = total_threads;
+    }
+
+    int response = batch_compile(batch);
+    batch_print_summary(batch, stdout);
+    batch_free(batch);
+    return response == COMPILER_FILE_COMPILE_SUCCESS ? 0 : 1;
+}
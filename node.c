@@ -1,43 +1,84 @@
+#include <stdlib.h>
 #include <assert.h>
 
 #include "compiler.h"
 #include "helpers/vector.h"
 
-struct vector *node_vector = NULL;
-struct vector *node_vector_root = NULL;
+#define AST_INITIAL_CAPACITY 1024
 
-void node_set_vector(struct vector *vec, struct vector *root)
+static void ast_grow(struct ast *ast)
 {
-    node_vector = vec;
-    node_vector_root = root;
+    uint32_t capacity = ast->capacity ? ast->capacity * 2 : AST_INITIAL_CAPACITY;
+    ast->nodes = realloc(ast->nodes, capacity * sizeof(struct node));
+    ast->offsets = realloc(ast->offsets, capacity * sizeof(uint32_t));
+    ast->binded = realloc(ast->binded, capacity * sizeof(struct node_binded));
+    assert(ast->nodes && ast->offsets && ast->binded);
+    ast->capacity = capacity;
+    ast->total_allocations += 3;
 }
 
-void node_push(struct node *node)
+void ast_free(struct ast *ast)
 {
-    vector_push(node_vector, &node);
+    free(ast->nodes);
+    free(ast->offsets);
+    free(ast->binded);
 }
 
-struct node *node_peek_or_null()
+size_t ast_memory_usage(struct ast *ast)
 {
-    return vector_back_ptr_or_null(node_vector);
+    return ast->capacity * (sizeof(struct node) + sizeof(uint32_t) + sizeof(struct node_binded));
 }
 
-struct node *node_peek()
+struct node *node_at(struct compile_process *process, uint32_t node)
 {
-    return *(struct node **)vector_back(node_vector);
+    assert(node != NODE_NONE && node < process->ast.count);
+    return &process->ast.nodes[node];
 }
 
-struct node *node_pop()
+struct pos node_pos(struct compile_process *process, uint32_t node)
 {
-    struct node *last_node = vector_back_ptr(node_vector);
-    struct node *last_node_root = vector_empty(node_vector_root) ? NULL : vector_back_ptr_or_null(node_vector_root);
+    assert(node != NODE_NONE && node < process->ast.count);
+    return token_store_pos_at_offset(process->token_store, process->ast.offsets[node]);
+}
+
+struct node_binded *node_binded(struct compile_process *process, uint32_t node)
+{
+    assert(node != NODE_NONE && node < process->ast.count);
+    return &process->ast.binded[node];
+}
+
+void node_push(struct compile_process *process, uint32_t node)
+{
+    node_vector_push(process->node_vec, node);
+}
+
+struct node *node_peek_or_null(struct compile_process *process)
+{
+    uint32_t *node = node_vector_back_or_null(process->node_vec);
+    return node ? node_at(process, *node) : NULL;
+}
+
+struct node *node_peek(struct compile_process *process)
+{
+    return node_at(process, node_peek_index(process));
+}
+
+uint32_t node_peek_index(struct compile_process *process)
+{
+    uint32_t *node = node_vector_back_or_null(process->node_vec);
+    assert(node);
+    return *node;
+}
 
-    vector_pop(node_vector);
+uint32_t node_pop(struct compile_process *process)
+{
+    uint32_t last_node = node_vector_pop(process->node_vec);
+    uint32_t *last_node_root = node_vector_back_or_null(process->node_tree_vec);
 
     // Remove node from last_node_root if it is also the same node
-    if (last_node == last_node_root)
+    if (last_node_root && last_node == *last_node_root)
     {
-        vector_pop(node_vector_root);
+        node_vector_pop(process->node_tree_vec);
     }
 
     return last_node;
@@ -48,29 +89,43 @@ bool node_is_expressionable(struct node *node)
     return node->type == NODE_TYPE_EXPRESSION ||
         node->type == NODE_TYPE_EXPRESSION_PARENTHESES ||
         node->type == NODE_TYPE_UNARY ||
+        node->type == NODE_TYPE_NUMBER ||
         node->type == NODE_TYPE_IDENTIFIER ||
         node->type == NODE_TYPE_STRING;
 }
 
-struct node *node_peek_expressionable_or_null()
+struct node *node_peek_expressionable_or_null(struct compile_process *process)
 {
-    struct node *last_node = node_peek_or_null();
-    return node_is_expressionable(last_node) ? last_node : NULL;
+    struct node *last_node = node_peek_or_null(process);
+    return last_node && node_is_expressionable(last_node) ? last_node : NULL;
 }
 
-void make_exp_node(struct node *left_node, struct node *right_node, const char *op)
+void make_exp_node(struct compile_process *process, uint32_t left_node, uint32_t right_node, int op)
 {
-    assert(left_node);
-    assert(right_node);
-    node_create(&(struct node){.type = NODE_TYPE_EXPRESSION, .exp = {.left = left_node, .right = right_node, .op = op}});
+    assert(left_node != NODE_NONE);
+    assert(right_node != NODE_NONE);
+    node_create(process, &(struct node){.type = NODE_TYPE_EXPRESSION, .op = op, .exp = {.left = left_node, .right = right_node}});
 }
 
-struct node *node_create(struct node *_node)
+uint32_t node_create(struct compile_process *process, struct node *_node)
 {
-    struct node *node = malloc(sizeof(struct node));
-    assert(node);
-    memcpy(node, _node, sizeof(struct node));
+    struct ast *ast = &process->ast;
+    if (ast->count == NODE_NONE)
+    {
+        // Index 0 stands for no node, so nothing may live there
+        ast_grow(ast);
+        ast->count = 1;
+    }
+    else if (ast->count == ast->capacity)
+    {
+        ast_grow(ast);
+    }
+
+    uint32_t node = ast->count++;
+    ast->nodes[node] = *_node;
+    ast->offsets[node] = process->parser.last_token_offset;
+    ast->binded[node] = (struct node_binded){.owner = NODE_NONE, .function = NODE_NONE};
     #warning TODO: we should set the binding owner and binding function here
-    node_push(node);
+    node_push(process, node);
     return node;
 }
@@ -1,314 +1,389 @@
 #include "compiler.h"
 #include "helpers/vector.h"
+#include "helpers/arena.h"
 
 #include <assert.h>
 
-static struct compile_process *current_process;
-static struct token *parser_last_token;
-extern struct expressionable_op_precedence_group op_precedence[TOTAL_OPERATOR_GROUPS];
 
-struct history
+struct history history_begin(int flags)
 {
-    int flags;
-};
-
-struct history *history_begin(int flags)
-{
-    struct history *history = malloc(sizeof(struct history));
-    history->flags = flags;
-    return history;
+    return (struct history){.flags = flags};
 }
 
-struct history *history_down(struct history *history, int flags)
+// Scans the one byte kinds in the token store rather than the full tokens.
+static void parser_ignore_nl_or_comment(struct compile_process *process)
 {
-    struct history *new_history = malloc(sizeof(struct history));
-    memcpy(new_history, history, sizeof(struct history));
-    return new_history;
+    if (process->token_stream)
+    {
+        token_stream_skip_newlines_and_comments(process->token_stream);
+        return;
+    }
+    process->parser.token_index = token_store_skip_newlines_and_comments(process->token_store, process->parser.token_index);
 }
 
-static void parser_ignore_nl_or_comment(struct token *token)
+// Expands the token at index into slot, NULL past the last token.
+static struct token *parser_token_at(struct compile_process *process, int index, struct token *slot)
 {
-    while (token && token_is_newline_or_comment(token))
+    if (index >= token_store_count(process->token_store))
     {
-        vector_peek(current_process->tokens); // skip the nl or comment token
-        token = vector_peek_no_increment(current_process->tokens);
+        return NULL;
     }
+
+    if (index == process->parser.peeked_index)
+    {
+        if (slot != &process->parser.peeked_token)
+        {
+            *slot = process->parser.peeked_token;
+        }
+        return slot;
+    }
+    token_store_token(process->token_store, index, slot);
+    return slot;
 }
 
-static struct token *token_next()
+static struct token *token_next(struct compile_process *process)
 {
-    struct token *next_token = vector_peek_no_increment(current_process->tokens);
-    parser_ignore_nl_or_comment(next_token);
-    current_process->pos = next_token->pos;
-    parser_last_token = next_token;
-    return vector_peek(current_process->tokens); // not just next_token because parser_ignore_nl_or_comment may have incremented the pointer.
+    parser_ignore_nl_or_comment(process);
+    struct token *next_token = NULL;
+    if (process->token_stream)
+    {
+        next_token = token_stream_next(process->token_stream);
+        if (next_token)
+        {
+            process->parser.last_token_offset = token_stream_last_offset(process->token_stream);
+        }
+    }
+    else
+    {
+        int index = process->parser.token_index;
+        next_token = parser_token_at(process, index, &process->parser.next_token);
+        if (next_token)
+        {
+            process->parser.token_index++;
+            process->parser.last_token_offset = token_store_offset(process->token_store, index);
+        }
+    }
+    process->pos = next_token->pos;
+    process->parser.last_token = next_token;
+    return next_token;
 }
 
 // Like token_next(), but doesn't increment the pointer.
-static struct token *token_peek_next()
+static struct token *token_peek_next(struct compile_process *process)
 {
-    struct token *next_token = vector_peek_no_increment(current_process->tokens);
-    parser_ignore_nl_or_comment(next_token);
-    return vector_peek_no_increment(current_process->tokens); // not just next_token because parser_ignore_nl_or_comment may have incremented the pointer.
+    parser_ignore_nl_or_comment(process);
+    if (process->token_stream)
+    {
+        return token_stream_peek(process->token_stream);
+    }
+    int index = process->parser.token_index;
+    struct token *token = parser_token_at(process, index, &process->parser.peeked_token);
+    if (token)
+    {
+        process->parser.peeked_index = index;
+    }
+    return token;
 }
 
-static bool token_next_is_op(const char *op)
+static bool token_next_is_op(struct compile_process *process, int op)
 {
-    struct token *token = token_peek_next();
-    return token_is_operator(token, op);
+    struct token *token = token_peek_next(process);
+    return token_is_operator_id(token, op);
 }
 
-void parse_single_token_to_node()
+void parse_single_token_to_node(struct compile_process *process)
 {
-    struct token *token = token_next();
-    struct node *node = NULL;
+    struct token *token = token_next(process);
     switch (token->type)
     {
     case TOKEN_TYPE_NUMBER:
-        node = node_create(&(struct node){.type = NODE_TYPE_NUMBER, .llnum = token->llnum});
+        node_create(process, &(struct node){.type = NODE_TYPE_NUMBER, .llnum = token->llnum});
         break;
     case TOKEN_TYPE_IDENTIFIER:
-        node = node_create(&(struct node){.type = NODE_TYPE_IDENTIFIER, .sval = token->sval});
+        node_create(process, &(struct node){.type = NODE_TYPE_IDENTIFIER, .sval = token->sval});
         break;
     case TOKEN_TYPE_STRING:
-        node = node_create(&(struct node){.type = NODE_TYPE_STRING, .sval = token->sval});
+        node_create(process, &(struct node){.type = NODE_TYPE_STRING, .sval = token->sval});
         break;
     default:
-        compiler_error(current_process, "Unexpected single token type %i\n", token->type);
+        compiler_error(process, "Unexpected single token type %i\n", token->type);
     }
 }
 
-void parse_expressionable_for_op(struct history *history, const char *op)
+void parse_identifier(struct compile_process *process, struct history *history)
 {
-    parse_expressionable(history);
+    assert(token_peek_next(process)->type == TOKEN_TYPE_IDENTIFIER);
+    parse_single_token_to_node(process);
 }
 
-static int parser_get_op_precedence_for_op(const char *op, struct expressionable_op_precedence_group **group_out)
+// Parses a single operand, a number, string or identifier.
+static int parse_exp_operand(struct compile_process *process, struct history *history)
 {
-    *group_out = NULL;
-    for (int i = 0; i < TOTAL_OPERATOR_GROUPS; i++)
+    struct token *token = token_peek_next(process);
+    if (!token)
     {
-        struct expressionable_op_precedence_group *group = &op_precedence[i];
-        for (int j = 0; group->operators[j]; j++)
-        {
-            const char *_op = op_precedence[i].operators[j];
-            if (S_EQ(op, _op))
-            {
-                *group_out = group;
-                return i;
-            }
-        }
+        return -1;
+    }
+
+    switch (token->type)
+    {
+    case TOKEN_TYPE_NUMBER:
+    case TOKEN_TYPE_STRING:
+        parse_single_token_to_node(process);
+        return 0;
+    case TOKEN_TYPE_IDENTIFIER:
+        parse_identifier(process, history);
+        return 0;
     }
 
     return -1;
 }
 
-static bool parser_left_op_has_priority(const char *op_left, const char *op_right)
+static void parse_exp_stack_push(struct compile_process *process, int op)
 {
-    struct expressionable_op_precedence_group *group_left = NULL;
-    struct expressionable_op_precedence_group *group_right = NULL;
-
-    if (S_EQ(op_left, op_right))
+    struct vector *stack = process->parser.exp_stack;
+    if (vector_count(stack) >= process->parser.max_expression_depth)
     {
-        return false;
+        compiler_error(process, "Expression nests too deeply, more than %i operators and parentheses are open at once", process->parser.max_expression_depth);
     }
-
-    int precedence_left = parser_get_op_precedence_for_op(op_left, &group_left);
-    int precedence_right = parser_get_op_precedence_for_op(op_right, &group_right);
-    if (group_left->associtivity == ASSOCIATIVITY_RIGHT_TO_LEFT)
-    {
-        return false;
-    }
-
-    return precedence_left <= precedence_right;
+    vector_push(stack, &(struct parser_exp_frame){.op = op});
 }
 
-void parser_node_shift_children_left(struct node *node)
+// Folds the operator on top of the stack and the two operands on top of the node stack into one expression.
+static void parse_exp_reduce(struct compile_process *process)
 {
-    assert(node->type == NODE_TYPE_EXPRESSION);
-    assert(node->exp.right->type != NODE_TYPE_EXPRESSION);
-
-    const char *right_op = node->exp.right->exp.op;
-    struct node *new_exp_left_node = node->exp.left;
-    struct node *new_exp_right_node = node->exp.right->exp.left;
-    make_exp_node(new_exp_left_node, new_exp_right_node, node->exp.op);
-    struct node *new_left_operand = node_pop();
-    struct node *new_right_operand = node->exp.right->exp.right;
+    struct parser_exp_frame *frame = vector_back(process->parser.exp_stack);
+    int op = frame->op;
+    vector_pop(process->parser.exp_stack);
 
-    node->exp.left = new_left_operand;
-    node->exp.right = new_right_operand;
-    node->exp.op = right_op;
+    uint32_t node_right = node_pop(process);
+    uint32_t node_left = node_pop(process);
+    node_at(process, node_left)->flags |= NODE_FLAG_INSIDE_EXPRESSION;
+    node_at(process, node_right)->flags |= NODE_FLAG_INSIDE_EXPRESSION;
+    make_exp_node(process, node_left, node_right, op);
 }
 
-void parser_reorder_expression(struct node **node_out)
+// Parses any opening parentheses and then the operand they lead up to.
+static void parse_exp_operand_with_parentheses(struct compile_process *process, struct history *history, int *open_parentheses, const char *after)
 {
-    struct node *node = *node_out;
-    if (node->type != NODE_TYPE_EXPRESSION)
+    while (token_next_is_op(process, OPERATOR_LEFT_PARENTHESIS))
     {
-        return;
+        after = token_next(process)->sval;
+        parse_exp_stack_push(process, OPERATOR_NONE);
+        (*open_parentheses)++;
     }
 
-    // No expression. Nothign to reorder.
-    if (node->exp.left->type == NODE_TYPE_EXPRESSION && node->exp.right && node->exp.right->type != NODE_TYPE_EXPRESSION)
+    if (parse_exp_operand(process, history) != 0)
     {
-        return;
+        compiler_error(process, "Expected an operand after '%s'", after);
     }
+}
 
-    // E.g. 30+(50+20). 30 is not an exp, but 50+20 is. We need to reorder.
-    if (node->exp.left->type != NODE_TYPE_EXPRESSION && node->exp.right && node->exp.right->type == NODE_TYPE_EXPRESSION)
+static void parse_exp_close_parentheses(struct compile_process *process)
+{
+    struct vector *stack = process->parser.exp_stack;
+    while (((struct parser_exp_frame *)vector_back(stack))->op != OPERATOR_NONE)
     {
-        const char *right_op = node->exp.right->exp.op;
-        if (parser_left_op_has_priority(node->exp.op, right_op))
-        {
-            parser_node_shift_children_left(node);
-            parser_reorder_expression(&node->exp.left);
-            parser_reorder_expression(&node->exp.right);
-        }
+        parse_exp_reduce(process);
     }
+    vector_pop(stack);
+
+    uint32_t exp_node = node_pop(process);
+    node_at(process, exp_node)->flags |= NODE_FLAG_INSIDE_EXPRESSION;
+    node_create(process, &(struct node){.type = NODE_TYPE_EXPRESSION_PARENTHESES, .parenthesis = {.exp = exp_node}});
 }
 
-void parse_exp_normal(struct history *history)
+/*
+ * Precedence climbing without recursion. Operators that are still waiting for
+ * their right operand, and open parentheses, go on process->parser.exp_stack,
+ * operands go on the node stack. An operator folds in the ones on the stack
+ * that bind at least as tightly before it is pushed itself, so a - b - c comes
+ * out as (a - b) - c and a = b = c as a = (b = c). However long or deeply
+ * nested the expression, the C stack stays flat, only exp_stack grows, up to
+ * max_expression_depth. Precedence groups run from 0, the tightest, upwards,
+ * see operators.def.
+ *
+ * With has_left the left operand is already on top of the node stack.
+ */
+static void parse_exp_operators(struct compile_process *process, struct history *history, bool has_left)
 {
-    struct token *op_token = token_peek_next();
-    const char *op = op_token->sval;
-    struct node *node_left = node_peek_expressionable_or_null();
+    struct vector *stack = process->parser.exp_stack;
+    int stack_base = vector_count(stack);
+    int open_parentheses = 0;
+    if (!has_left)
+    {
+        parse_exp_operand_with_parentheses(process, history, &open_parentheses, "(");
+    }
 
-    if (!node_left)
+    while (1)
     {
-        return;
+        struct token *op_token = token_peek_next(process);
+        if (!op_token)
+        {
+            break;
+        }
+
+        if (open_parentheses > 0 && token_is_symbol(op_token, ')'))
+        {
+            token_next(process);
+            parse_exp_close_parentheses(process);
+            open_parentheses--;
+            continue;
+        }
+
+        if (op_token->type != TOKEN_TYPE_OPERATOR)
+        {
+            break;
+        }
+
+        const struct operator *op_info = &operators[op_token->op];
+        if (op_info->precedence < 0)
+        {
+            break;
+        }
+
+        while (vector_count(stack) > stack_base)
+        {
+            struct parser_exp_frame *frame = vector_back(stack);
+            if (frame->op == OPERATOR_NONE)
+            {
+                break;
+            }
+
+            // The same group stays open when it is right associative
+            const struct operator *top_info = &operators[frame->op];
+            if (top_info->precedence > op_info->precedence ||
+                (top_info->precedence == op_info->precedence && op_info->associativity == ASSOCIATIVITY_RIGHT_TO_LEFT))
+            {
+                break;
+            }
+            parse_exp_reduce(process);
+        }
+
+        token_next(process);
+        parse_exp_stack_push(process, op_token->op);
+        parse_exp_operand_with_parentheses(process, history, &open_parentheses, op_token->sval);
     }
 
-    // Pop off operator token
-    token_next();
+    if (open_parentheses > 0)
+    {
+        compiler_error(process, "Expected ')' to close the parentheses");
+    }
 
-    // Pop off left node
-    node_pop();
-    node_left->flags |= NODE_FLAG_INSIDE_EXPRESSION;
-    parse_expressionable_for_op(history_down(history_begin(0), history->flags), op);
+    while (vector_count(stack) > stack_base)
+    {
+        parse_exp_reduce(process);
+    }
+}
 
-    // Pop off right node
-    struct node *node_right = node_pop();
-    node_right->flags |= NODE_FLAG_INSIDE_EXPRESSION;
-    make_exp_node(node_left, node_right, op);
-    struct node *exp_node = node_pop();
+int parse_exp_normal(struct compile_process *process, struct history *history)
+{
+    // Nothing to do if there is no left operand for the operator
+    if (!node_peek_expressionable_or_null(process))
+    {
+        return -1;
+    }
 
-    // Reorder the expression
-    parser_reorder_expression(&exp_node);
-    node_push(exp_node);
+    parse_exp_operators(process, history, true);
+    return 0;
 }
 
-int parse_exp(struct history *history)
+// An expression that starts with an opening parenthesis
+int parse_exp_parentheses(struct compile_process *process, struct history *history)
 {
-    parse_exp_normal(history);
+    history->flags |= NODE_FLAG_INSIDE_EXPRESSION;
+    parse_exp_operators(process, history, false);
     return 0;
 }
 
-void parse_identifier(struct history *history)
+int parse_exp(struct compile_process *process, struct history *history)
 {
-    assert(token_peek_next()->type == TOKEN_TYPE_IDENTIFIER);
-    parse_single_token_to_node();
+    return parse_exp_normal(process, history);
 }
 
-static bool is_keyword_variation_modifier(const char *val)
+static bool is_keyword_variation_modifier(struct token *token)
 {
-    return S_EQ(val, "const") ||
-           S_EQ(val, "static") ||
-           S_EQ(val, "__ignore_typecheck__") ||
-           S_EQ(val, "extern") ||
-           S_EQ(val, "unsigned") ||
-           S_EQ(val, "signed");
+    return token->type == TOKEN_TYPE_KEYWORD && keyword_has_flag(token->keyword, KEYWORD_FLAG_MODIFIER);
 }
 
-void parse_datatype_modifiers(struct datatype *dtype)
+void parse_datatype_modifiers(struct compile_process *process, struct datatype *dtype)
 {
-    struct token *token = token_peek_next();
-    while (token && is_keyword_variation_modifier(token->sval))
+    struct token *token = token_peek_next(process);
+    while (token && is_keyword_variation_modifier(token))
     {
-        if (!is_keyword_variation_modifier(token->sval))
-        {
-            break;
-        }
-
-        if (S_EQ(token->sval, "const"))
+        switch (token->keyword)
         {
+        case KEYWORD_CONST:
             dtype->flags |= DATATYPE_FLAG_IS_CONST;
-        }
-        else if (S_EQ(token->sval, "static"))
-        {
+            break;
+        case KEYWORD_STATIC:
             dtype->flags |= DATATYPE_FLAG_IS_STATIC;
-        }
-        else if (S_EQ(token->sval, "__ignore_typecheck__"))
-        {
+            break;
+        case KEYWORD_IGNORE_TYPECHECK:
             dtype->flags |= DATATYPE_FLAG_IS_IGNORE_TYPECHECK;
-        }
-        else if (S_EQ(token->sval, "extern"))
-        {
+            break;
+        case KEYWORD_EXTERN:
             dtype->flags |= DATATYPE_FLAG_IS_EXTERN;
-        }
-        else if (S_EQ(token->sval, "unsigned"))
-        {
+            break;
+        case KEYWORD_UNSIGNED:
             dtype->flags &= ~DATATYPE_FLAG_IS_SIGNED;
-        }
-        else if (S_EQ(token->sval, "signed"))
-        {
+            break;
+        case KEYWORD_SIGNED:
             dtype->flags |= DATATYPE_FLAG_IS_SIGNED;
+            break;
         }
-        token_next();
-        token = token_peek_next();
+        token_next(process);
+        token = token_peek_next(process);
     }
 }
 
-void parser_get_datatype_tokens(struct token **datatype_token, struct token **secondary_datatype_token)
+// Copies the tokens out, the parser reuses the ones token_next returns. True if there is a secondary one.
+bool parser_get_datatype_tokens(struct compile_process *process, struct token *datatype_token, struct token *secondary_datatype_token)
 {
-    *datatype_token = token_next();
-    struct token *next_token = token_peek_next();
+    *datatype_token = *token_next(process);
+    struct token *next_token = token_peek_next(process);
     if (token_is_primitive_keyword(next_token))
     {
-        *secondary_datatype_token = next_token;
-        token_next();
+        *secondary_datatype_token = *next_token;
+        token_next(process);
+        return true;
     }
+    return false;
 }
 
-int parser_datatype_expected_for_type_string(const char *str)
+int parser_datatype_expected_for_type_token(struct token *token)
 {
     int type = DATATYPE_EXPECT_PRIMITIVE;
-    if (S_EQ(str, "union"))
+    if (token_is_keyword_id(token, KEYWORD_UNION))
     {
         type = DATATYPE_EXPECT_UNION;
     }
-    else if (S_EQ(str, "struct"))
+    else if (token_is_keyword_id(token, KEYWORD_STRUCT))
     {
         type = DATATYPE_EXPECT_STRUCT;
     }
     return type;
 }
 
-int parser_get_random_type_index()
+int parser_get_random_type_index(struct compile_process *process)
 {
-    static int x = 0;
-    x++;
-    return x;
+    return ++process->parser.random_type_index;
 }
 
-struct token *parse_build_random_type_name()
+struct token parse_build_random_type_name(struct compile_process *process)
 {
     char tmp_name[25];
-    sprintf(tmp_name, "__tmp_type_%i", parser_get_random_type_index());
-    char *sval = malloc(sizeof(tmp_name));
-    strncpy(sval, tmp_name, sizeof(tmp_name));
-    struct token *token = malloc(sizeof(struct token));
-    token->type = TOKEN_TYPE_IDENTIFIER;
-    token->sval = sval;
-    return token;
+    int len = sprintf(tmp_name, "__tmp_type_%i", parser_get_random_type_index(process));
+    return (struct token){.type = TOKEN_TYPE_IDENTIFIER, .sval = intern_string(process->intern_pool, tmp_name, len)};
 }
 
-int parser_get_pointer_depth()
+int parser_get_pointer_depth(struct compile_process *process)
 {
     int pointer_depth = 0;
-    while (token_next_is_op("*"))
+    while (token_next_is_op(process, OPERATOR_MULTIPLY))
     {
         pointer_depth++;
-        token_next();
+        token_next(process);
     }
     return pointer_depth;
 }
@@ -318,158 +393,150 @@ bool parser_datatype_is_secondary_allowed(int expected_type)
     return expected_type == DATATYPE_EXPECT_PRIMITIVE;
 }
 
-bool parser_datatype_is_secondary_allowed_for_type(const char *type)
+bool parser_datatype_is_secondary_allowed_for_type(struct token *token)
 {
-    return S_EQ(type, "float") ||
-           S_EQ(type, "double") ||
-           S_EQ(type, "short") ||
-           S_EQ(type, "long");
+    switch (token->keyword)
+    {
+    case KEYWORD_FLOAT:
+    case KEYWORD_DOUBLE:
+    case KEYWORD_SHORT:
+    case KEYWORD_LONG:
+        return true;
+    }
+    return false;
 }
 
-void parser_datatype_init_and_size_for_primitive(struct token *datatype_token, struct token *secondary_datatype_token, struct datatype *datatype_out)
+void parser_datatype_init_and_size_for_primitive(struct compile_process *process, struct token *datatype_token, struct token *secondary_datatype_token, struct datatype *datatype_out)
 {
-    if (!parser_datatype_is_secondary_allowed_for_type(datatype_token->sval) && secondary_datatype_token)
+    if (!parser_datatype_is_secondary_allowed_for_type(datatype_token) && secondary_datatype_token)
     {
-        compiler_error(current_process, "Unexpected secondary datatype %s\n", secondary_datatype_token->sval);
+        compiler_error(process, "Unexpected secondary datatype %s\n", secondary_datatype_token->sval);
     }
 
-    if (S_EQ(datatype_token->sval, "void"))
+    switch (datatype_token->keyword)
     {
+    case KEYWORD_VOID:
         datatype_out->type = DATATYPE_VOID;
         datatype_out->size = DATA_SIZE_ZERO;
         return;
-    }
-    else if (S_EQ(datatype_token->sval, "char"))
-    {
+    case KEYWORD_CHAR:
         datatype_out->type = DATATYPE_CHAR;
         datatype_out->size = DATA_SIZE_BYTE;
         return;
-    }
-    else if (S_EQ(datatype_token->sval, "short"))
-    {
+    case KEYWORD_SHORT:
         datatype_out->type = DATATYPE_SHORT;
         datatype_out->size = DATA_SIZE_WORD;
         return;
-    }
-    else if (S_EQ(datatype_token->sval, "int"))
-    {
+    case KEYWORD_INT:
         datatype_out->type = DATATYPE_INT;
         datatype_out->size = DATA_SIZE_DWORD;
         return;
-    }
-    else if (S_EQ(datatype_token->sval, "long"))
-    {
+    case KEYWORD_LONG:
         datatype_out->type = DATATYPE_LONG;
         datatype_out->size = DATA_SIZE_DWORD; // TODO: actually DDWORD, but we will adjust later
         return;
-    }
-    else if (S_EQ(datatype_token->sval, "float"))
-    {
+    case KEYWORD_FLOAT:
         datatype_out->type = DATATYPE_FLOAT;
         datatype_out->size = DATA_SIZE_DWORD;
         return;
-    }
-    else if (S_EQ(datatype_token->sval, "double"))
-    {
+    case KEYWORD_DOUBLE:
         datatype_out->type = DATATYPE_DOUBLE;
         datatype_out->size = DATA_SIZE_DWORD; // TODO: actually DDWORD, but we will adjust later
         return;
-    }
-    else
-    {
-        compiler_error(current_process, "Unexpected primitive datatype %s\n", datatype_token->sval);
+    default:
+        compiler_error(process, "Unexpected primitive datatype %s\n", datatype_token->sval);
     }
 
-    parser_datatype_adjust_size_for_secondary(datatype_out, secondary_datatype_token);
+    parser_datatype_adjust_size_for_secondary(process, datatype_out, secondary_datatype_token);
 }
 
-void parser_datatype_adjust_size_for_secondary(struct datatype *datatype, struct token *secondary_datatype_token)
+void parser_datatype_adjust_size_for_secondary(struct compile_process *process, struct datatype *datatype, struct token *secondary_datatype_token)
 {
     if (!secondary_datatype_token)
     {
         return;
     }
 
-    struct datatype *secondary_datatype = malloc(sizeof(struct datatype));
-    parser_datatype_init_and_size_for_primitive(secondary_datatype_token, NULL, secondary_datatype);
+    struct datatype *secondary_datatype = arena_calloc(process->arena, sizeof(struct datatype));
+    parser_datatype_init_and_size_for_primitive(process, secondary_datatype_token, NULL, secondary_datatype);
     datatype->size += secondary_datatype->size;
     datatype->datatype_secondary = secondary_datatype;
     datatype->flags |= DATATYPE_FLAG_IS_SECONDARY;
 }
 
-void parser_datatype_init_type_and_size(struct token *datatype_token, struct token *secondary_datatype_token, struct datatype *datatype_out, int pointer_depth, int expected_type)
+void parser_datatype_init_type_and_size(struct compile_process *process, struct token *datatype_token, struct token *secondary_datatype_token, struct datatype *datatype_out, int pointer_depth, int expected_type)
 {
     if (!parser_datatype_is_secondary_allowed(expected_type) && secondary_datatype_token)
     {
-        compiler_error(current_process, "Unexpected secondary datatype %s\n", secondary_datatype_token->sval);
+        compiler_error(process, "Unexpected secondary datatype %s\n", secondary_datatype_token->sval);
     }
 
     switch (expected_type)
     {
     case DATATYPE_EXPECT_PRIMITIVE:
-        parser_datatype_init_and_size_for_primitive(datatype_token, secondary_datatype_token, datatype_out);
+        parser_datatype_init_and_size_for_primitive(process, datatype_token, secondary_datatype_token, datatype_out);
         break;
     case DATATYPE_EXPECT_STRUCT:
     case DATATYPE_EXPECT_UNION:
-        compiler_error(current_process, "Currently not support struct or union datatype %s\n", datatype_token->sval);
+        compiler_error(process, "Currently not support struct or union datatype %s\n", datatype_token->sval);
         break;
     default:
-        compiler_error(current_process, "Unexpected datatype %s\n", datatype_token->sval);
+        compiler_error(process, "Unexpected datatype %s\n", datatype_token->sval);
     }
 }
 
-void parser_datatype_init(struct token *datatype_token, struct token *secondary_datatype_token, struct datatype *datatype_out, int pointer_depth, int expected_type)
+void parser_datatype_init(struct compile_process *process, struct token *datatype_token, struct token *secondary_datatype_token, struct datatype *datatype_out, int pointer_depth, int expected_type)
 {
-    parser_datatype_init_type_and_size(datatype_token, secondary_datatype_token, datatype_out, pointer_depth, expected_type);
+    parser_datatype_init_type_and_size(process, datatype_token, secondary_datatype_token, datatype_out, pointer_depth, expected_type);
     datatype_out->type_str = datatype_token->sval;
 
-    if (S_EQ(datatype_token->sval, "long") && secondary_datatype_token && S_EQ(secondary_datatype_token->sval, "long"))
+    if (token_is_keyword_id(datatype_token, KEYWORD_LONG) && token_is_keyword_id(secondary_datatype_token, KEYWORD_LONG))
     {
-        compiler_warning(current_process, "long long is current not supported. The compiler now uses long instead.\n");
+        compiler_warning(process, "long long is current not supported. The compiler now uses long instead.\n");
         datatype_out->size = DATA_SIZE_DWORD;
     }
 
 }
 
-void parse_datatype_type(struct datatype *dtype)
+void parse_datatype_type(struct compile_process *process, struct datatype *dtype)
 {
-    struct token *datatype_token = NULL;
-    struct token *secondary_datatype_token = NULL;
-    parser_get_datatype_tokens(&datatype_token, &secondary_datatype_token);
-    int expected_type = parser_datatype_expected_for_type_string(datatype_token->sval);
-    if (datatype_is_struct_or_union_for_name(datatype_token->sval))
+    struct token datatype_token;
+    struct token secondary_datatype_token;
+    bool has_secondary = parser_get_datatype_tokens(process, &datatype_token, &secondary_datatype_token);
+    int expected_type = parser_datatype_expected_for_type_token(&datatype_token);
+    if (expected_type != DATATYPE_EXPECT_PRIMITIVE)
     {
-        if (token_peek_next()->type == TOKEN_TYPE_IDENTIFIER) // named struct or named union
+        if (token_peek_next(process)->type == TOKEN_TYPE_IDENTIFIER) // named struct or named union
         {
-            datatype_token = token_next();
+            datatype_token = *token_next(process);
         }
         else // anonymous struct or anonymous union
         {
-            datatype_token = parse_build_random_type_name();
+            datatype_token = parse_build_random_type_name(process);
             dtype->flags |= DATATYPE_FLAG_IS_STRUCT_UNION_NO_NAME;
         }
     }
 
-    int pointer_depth = parser_get_pointer_depth();
-    parser_datatype_init(datatype_token, secondary_datatype_token, dtype, pointer_depth, expected_type);
+    int pointer_depth = parser_get_pointer_depth(process);
+    parser_datatype_init(process, &datatype_token, has_secondary ? &secondary_datatype_token : NULL, dtype, pointer_depth, expected_type);
 }
 
-void parse_datatype(struct datatype *dtype)
+void parse_datatype(struct compile_process *process, struct datatype *dtype)
 {
     memset(dtype, 0, sizeof(struct datatype));
     dtype->flags |= DATATYPE_FLAG_IS_SIGNED;
 
-    parse_datatype_modifiers(dtype);
-    parse_datatype_type(dtype);
-    parse_datatype_modifiers(dtype);
+    parse_datatype_modifiers(process, dtype);
+    parse_datatype_type(process, dtype);
+    parse_datatype_modifiers(process, dtype);
 }
 
-void parse_variable_function_or_struct_union(struct history *history)
+void parse_variable_function_or_struct_union(struct compile_process *process, struct history *history)
 {
     struct datatype dtype;
-    parse_datatype(&dtype);
+    parse_datatype(process, &dtype);
 
-    parser_ignore_int(&dtype);
+    parser_ignore_int(process, &dtype);
 }
 
 bool parser_is_int_valid_after_datatype(struct datatype *dtype)
@@ -477,10 +544,10 @@ bool parser_is_int_valid_after_datatype(struct datatype *dtype)
     return dtype->type == DATATYPE_SHORT || dtype->type == DATATYPE_LONG;
 }
 
-void parser_ignore_int(struct datatype *dtype)
+void parser_ignore_int(struct compile_process *process, struct datatype *dtype)
 {
     // Because 'long int' is the same is 'long', we can ignore the 'int' part
-    if (!token_is_keyword(token_peek_next(), "int"))
+    if (!token_is_keyword_id(token_peek_next(process), KEYWORD_INT))
     {
         return;
     }
@@ -488,24 +555,24 @@ void parser_ignore_int(struct datatype *dtype)
     // If the datatype is not short or long, then we should not have 'int' after it
     if (!parser_is_int_valid_after_datatype(dtype))
     {
-        compiler_error(current_process, "Unexpected 'int' after datatype %s\n", dtype->type_str);
+        compiler_error(process, "Unexpected 'int' after datatype %s\n", dtype->type_str);
     }
 
-    token_next();
+    token_next(process);
 }
 
-void parse_keyword(struct history *history)
+void parse_keyword(struct compile_process *process, struct history *history)
 {
-    struct token *token = token_peek_next();
-    if (is_keyword_variation_modifier(token->sval) || keyword_is_datatype(token->sval))
+    struct token *token = token_peek_next(process);
+    if (keyword_has_flag(token->keyword, KEYWORD_FLAG_MODIFIER | KEYWORD_FLAG_DATATYPE))
     {
-        parse_variable_function_or_struct_union(history);
+        parse_variable_function_or_struct_union(process, history);
     }
 }
 
-int parse_expressionable_single(struct history *history)
+int parse_expressionable_single(struct compile_process *process, struct history *history)
 {
-    struct token *token = token_peek_next();
+    struct token *token = token_peek_next(process);
     if (!token)
     {
         return -1;
@@ -516,19 +583,18 @@ int parse_expressionable_single(struct history *history)
     switch (token->type)
     {
     case TOKEN_TYPE_NUMBER:
-        parse_single_token_to_node();
+        parse_single_token_to_node(process);
         res = 0;
         break;
     case TOKEN_TYPE_IDENTIFIER:
-        parse_identifier(history);
+        parse_identifier(process, history);
         res = 0;
         break;
     case TOKEN_TYPE_OPERATOR:
-        parse_exp(history);
-        res = 0;
+        res = parse_exp(process, history);
         break;
     case TOKEN_TYPE_KEYWORD:
-        parse_keyword(history);
+        parse_keyword(process, history);
         res = 0;
         break;
     }
@@ -536,37 +602,46 @@ int parse_expressionable_single(struct history *history)
     return res;
 }
 
-void parse_expressionable(struct history *history)
+void parse_expressionable(struct compile_process *process, struct history *history)
 {
-    while (parse_expressionable_single(history) == 0)
+    while (parse_expressionable_single(process, history) == 0)
     {
     }
 }
 
-void parse_keyword_for_global()
+void parse_keyword_for_global(struct compile_process *process)
 {
-    parse_keyword(history_begin(0));
-    //struct node *node = node_pop();
+    struct history history = history_begin(0);
+    parse_keyword(process, &history);
+    //struct node *node = node_pop(process);
 }
 
-int parse_next()
+int parse_next(struct compile_process *process)
 {
-    struct token *token = token_peek_next();
+    struct token *token = token_peek_next(process);
     if (!token)
     {
         return -1;
     }
 
+    struct history history = history_begin(0);
     switch (token->type)
     {
     case TOKEN_TYPE_NUMBER:
     case TOKEN_TYPE_IDENTIFIER:
     case TOKEN_TYPE_STRING:
-        parse_expressionable_single(history_begin(0));
+        parse_expressionable(process, &history);
+        break;
+
+    case TOKEN_TYPE_OPERATOR:
+        if (token_is_operator_id(token, OPERATOR_LEFT_PARENTHESIS))
+        {
+            parse_exp_parentheses(process, &history);
+        }
         break;
-    
+
     case TOKEN_TYPE_KEYWORD:
-        parse_keyword_for_global();
+        parse_keyword_for_global(process);
         break;
     }
     return 0;
@@ -574,16 +649,15 @@ int parse_next()
 
 int parse(struct compile_process *process)
 {
-    current_process = process;
-    parser_last_token = NULL;
-    node_set_vector(process->node_vec, process->node_tree_vec);
-    struct node *node = NULL;
-    vector_set_peek_pointer(process->tokens, 0);
+    process->parser.last_token = NULL;
+    process->parser.token_index = 0;
+    process->parser.peeked_index = -1;
+    uint32_t node = NODE_NONE;
 
-    while (parse_next() == 0)
+    while (parse_next(process) == 0)
     {
-        node = node_peek();
-        vector_push(process->node_tree_vec, &node);
+        node = node_peek_index(process);
+        node_vector_push(process->node_tree_vec, node);
     }
     return PARSE_SUCCESS;
 }
\ No newline at end of file
@@ -5,20 +5,81 @@
 #include <stdlib.h>
 #include <assert.h>
 
+#define SCOPE_INITIAL_SLOTS 64
+
 struct scope *scope_alloc()
 {
-    struct scope *scope = malloc(sizeof(struct scope));
+    struct scope *scope = calloc(1, sizeof(struct scope));
     scope->entities = vector_create(sizeof(void *));
     vector_set_peek_pointer_end(scope->entities);  // set the peek pointer to the end of the vector instead of the beginning.
     vector_set_flag(scope->entities, VECTOR_FLAG_PEEK_DECREMENT);  // peeking backward instead of conventionally forward.
     return scope;
 }
 
+// The entities belong to whoever pushed them, only the scope's own memory goes
 void scope_dealloc(struct scope *scope)
 {
-    // TODO: free all entities
-    // vector_destroy(scope->entities);
-    // free(scope);
+    vector_free(scope->entities);
+    free(scope);
+}
+
+static void scope_bindings_create(struct compile_process *process)
+{
+    process->scope.bindings = vector_create(sizeof(struct scope_binding));
+    process->scope.slots = calloc(SCOPE_INITIAL_SLOTS, sizeof(struct scope_slot));
+    process->scope.total_slots = SCOPE_INITIAL_SLOTS;
+    process->scope.total_names = 0;
+}
+
+static void scope_bindings_free(struct compile_process *process)
+{
+    vector_free(process->scope.bindings);
+    free(process->scope.slots);
+    process->scope.bindings = NULL;
+    process->scope.slots = NULL;
+    process->scope.total_slots = 0;
+    process->scope.total_names = 0;
+}
+
+static struct scope_slot *scope_slot_for(struct scope_slot *slots, int total_slots, const char *name)
+{
+    uint32_t slot = intern_hash(name) & (total_slots - 1);
+    while (slots[slot].name && slots[slot].name != name)
+    {
+        slot = (slot + 1) & (total_slots - 1);
+    }
+    return &slots[slot];
+}
+
+// Names nothing is bound to any more are dropped on the way
+static void scope_slots_grow(struct compile_process *process)
+{
+    struct scope_slot *old_slots = process->scope.slots;
+    int old_total_slots = process->scope.total_slots;
+    process->scope.total_slots *= 2;
+    process->scope.slots = calloc(process->scope.total_slots, sizeof(struct scope_slot));
+    process->scope.total_names = 0;
+    for (int i = 0; i < old_total_slots; i++)
+    {
+        if (old_slots[i].name && old_slots[i].binding != -1)
+        {
+            *scope_slot_for(process->scope.slots, process->scope.total_slots, old_slots[i].name) = old_slots[i];
+            process->scope.total_names++;
+        }
+    }
+    free(old_slots);
+}
+
+// Undoes the bindings made in scope, bringing back the ones they shadowed.
+static void scope_unbind(struct compile_process *process, struct scope *scope)
+{
+    struct vector *bindings = process->scope.bindings;
+    while (vector_count(bindings) > scope->bindings_start)
+    {
+        struct scope_binding *binding = vector_back(bindings);
+        scope_slot_for(process->scope.slots, process->scope.total_slots, binding->name)->binding = binding->shadowed;
+        vector_pop(bindings);
+    }
 }
 
 // Create global (aka root) scope
@@ -28,17 +89,25 @@ struct scope *scope_create_root(struct compile_process *process)
     assert(!process->scope.current);
 
     struct scope *root_scope = scope_alloc();
+    scope_bindings_create(process);
     process->scope.root = root_scope;
     process->scope.current = root_scope;
     return root_scope;
 }
 
+// Frees the root along with any scopes still open inside it
 void scope_free_root(struct compile_process *process)
 {
-    scope_dealloc(process->scope.root);
+    struct scope *scope = process->scope.current;
+    while (scope)
+    {
+        struct scope *parent = scope->parent;
+        scope_dealloc(scope);
+        scope = parent;
+    }
+    scope_bindings_free(process);
     process->scope.root = NULL;
     process->scope.current = NULL;
-
 }
 
 struct scope *scope_new(struct compile_process *process, int flags)
@@ -48,6 +117,7 @@ struct scope *scope_new(struct compile_process *process, int flags)
 
     struct scope *new_scope = scope_alloc();
     new_scope->flags = flags;
+    new_scope->bindings_start = vector_count(process->scope.bindings);
     new_scope->parent = process->scope.current;
     process->scope.current = new_scope;
     return new_scope;
@@ -123,15 +193,60 @@ void scope_push(struct compile_process *process, void *entity, size_t entity_siz
     process->scope.current->size += entity_size;
 }
 
+void scope_bind(struct compile_process *process, const char *name, void *entity, size_t entity_size)
+{
+    scope_push(process, entity, entity_size);
+
+    if ((process->scope.total_names + 1) * 2 > process->scope.total_slots)
+    {
+        scope_slots_grow(process);
+    }
+
+    struct scope_slot *slot = scope_slot_for(process->scope.slots, process->scope.total_slots, name);
+    if (!slot->name)
+    {
+        slot->name = name;
+        slot->binding = -1;
+        process->scope.total_names++;
+    }
+
+    struct scope_binding binding = {.name = name, .entity = entity, .scope = process->scope.current, .shadowed = slot->binding};
+    slot->binding = vector_count(process->scope.bindings);
+    vector_push(process->scope.bindings, &binding);
+}
+
+struct scope_binding *scope_lookup_binding(struct compile_process *process, const char *name)
+{
+    if (!process->scope.slots)
+    {
+        return NULL;
+    }
+
+    struct scope_slot *slot = scope_slot_for(process->scope.slots, process->scope.total_slots, name);
+    if (!slot->name || slot->binding == -1)
+    {
+        return NULL;
+    }
+    return vector_at(process->scope.bindings, slot->binding);
+}
+
+void *scope_lookup(struct compile_process *process, const char *name)
+{
+    struct scope_binding *binding = scope_lookup_binding(process, name);
+    return binding ? binding->entity : NULL;
+}
+
 // Pop the last entity from the current scope, and if it is not found, look in the parent scope.
 void scope_finish(struct compile_process *process)
 {
     struct scope *new_current_scope = process->scope.current->parent;
+    scope_unbind(process, process->scope.current);
     scope_dealloc(process->scope.current);
     process->scope.current = new_current_scope;
     if (process->scope.root && !process->scope.current)
     {
         process->scope.root = NULL;
+        scope_bindings_free(process);
     }
 }
 
@@ -1,15 +1,67 @@
+#include <stdlib.h>
+
 #include "compiler.h"
 #include "helpers/vector.h"
+#include "helpers/arena.h"
+
+#define SYMBOL_TABLE_INITIAL_SLOTS 64
+
+static struct symbol_table *symbol_table_create()
+{
+    struct symbol_table *table = calloc(1, sizeof(struct symbol_table));
+    table->slots = calloc(SYMBOL_TABLE_INITIAL_SLOTS, sizeof(struct symbol *));
+    table->total_slots = SYMBOL_TABLE_INITIAL_SLOTS;
+    return table;
+}
+
+static void symbol_table_free(struct symbol_table *table)
+{
+    free(table->slots);
+    free(table);
+}
+
+// Symbol names are interned (see intern.c), so the hash is already known and a pointer compare is enough.
+static struct symbol **symbol_table_slot(struct symbol_table *table, const char *name)
+{
+    uint32_t slot = intern_hash(name) & (table->total_slots - 1);
+    while (table->slots[slot] && table->slots[slot]->name != name)
+    {
+        slot = (slot + 1) & (table->total_slots - 1);
+    }
+    return &table->slots[slot];
+}
 
+static void symbol_table_grow(struct symbol_table *table)
+{
+    struct symbol **old_slots = table->slots;
+    int old_total_slots = table->total_slots;
+    table->total_slots *= 2;
+    table->slots = calloc(table->total_slots, sizeof(struct symbol *));
+    for (int i = 0; i < old_total_slots; i++)
+    {
+        if (old_slots[i])
+        {
+            *symbol_table_slot(table, old_slots[i]->name) = old_slots[i];
+        }
+    }
+    free(old_slots);
+}
 
 static void symresolver_push_symbol(struct compile_process *process, struct symbol *sym)
 {
-    vector_push(process->symbols.table, &sym);
+    struct symbol_table *table = process->symbols.table;
+    if ((table->total_symbols + 1) * 2 > table->total_slots)
+    {
+        symbol_table_grow(table);
+    }
+
+    *symbol_table_slot(table, sym->name) = sym;
+    table->total_symbols++;
 }
 
 void sysrosolver_init(struct compile_process *process)
 {
-    process->symbols.tables = vector_create(sizeof(struct vector *));
+    process->symbols.tables = vector_create(sizeof(struct symbol_table *));
 
 }
 
@@ -19,29 +71,36 @@ void symresolver_new_table(struct compile_process *process)
     vector_push(process->symbols.tables, &process->symbols.table);
 
     // Overwrite the current table with a new one
-    process->symbols.table = vector_create(sizeof(struct symbol *));
+    process->symbols.table = symbol_table_create();
 }
 
 void symresolver_end_table(struct compile_process *process)
 {
-    struct vector *last_table = vector_back_ptr(process->symbols.tables);
+    // The symbols themselves live in the arena, only the slots go
+    symbol_table_free(process->symbols.table);
+
+    struct symbol_table *last_table = vector_back_ptr(process->symbols.tables);
     process->symbols.table = last_table;
     vector_pop(process->symbols.tables);
 }
 
-struct symbol *symresolver_get_symbol(struct compile_process *process, const char *name)
+void symresolver_free(struct compile_process *process)
 {
-    vector_set_peek_pointer(process->symbols.table, 0);
-    struct symbol *symbol = vector_peek_ptr(process->symbols.table);
-    while (symbol)
+    if (!process->symbols.tables)
     {
-        if (S_EQ(symbol->name, name))
-        {
-            break;
-        }
-        symbol = vector_peek_ptr(process->symbols.table);
+        return;
     }
-    return symbol;
+
+    while (process->symbols.table)
+    {
+        symresolver_end_table(process);
+    }
+    vector_free(process->symbols.tables);
+}
+
+struct symbol *symresolver_get_symbol(struct compile_process *process, const char *name)
+{
+    return *symbol_table_slot(process->symbols.table, name);
 }
 
 struct symbol *symresolver_get_symbol_for_native_function(struct compile_process *process, const char *name)
@@ -67,7 +126,7 @@ struct symbol *symresolver_register_symbol(struct compile_process *process, cons
         return NULL;
     }
 
-    struct symbol *symbol = malloc(sizeof(struct symbol));
+    struct symbol *symbol = arena_alloc(process->arena, sizeof(struct symbol));
     symbol->name = name;
     symbol->type = type;
     symbol->data = data;
@@ -75,13 +134,14 @@ struct symbol *symresolver_register_symbol(struct compile_process *process, cons
     return symbol;
 }
 
-struct node *symresolver_node(struct symbol *symbol)
+// Node symbols carry the index of their node in data, node pointers do not stay put
+uint32_t symresolver_node(struct symbol *symbol)
 {
     if (symbol->type != SYMBOL_TYPE_NODE)
     {
-        return NULL;
+        return NODE_NONE;
     }
-    return symbol->data;
+    return (uint32_t)(uintptr_t)symbol->data;
 }
 
 void symresolver_build_for_variable_node(struct compile_process *process, struct node *node)
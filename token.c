@@ -1,11 +1,13 @@
 #include "compiler.h"
 
-#define PRIMITIVE_TYPE_TOTAL 7
-const char *primitive_types[PRIMITIVE_TYPE_TOTAL] = {"int", "float", "double", "char", "short", "long", "void"};
-
 bool token_is_keyword(struct token *token, const char *keyword)
 {
-    return token && token->type == TOKEN_TYPE_KEYWORD && S_EQ(token->sval, keyword);
+    return token && token->type == TOKEN_TYPE_KEYWORD && intern_equals(token->sval, keyword);
+}
+
+bool token_is_keyword_id(struct token *token, int keyword)
+{
+    return token && token->type == TOKEN_TYPE_KEYWORD && token->keyword == keyword;
 }
 
 bool token_is_symbol(struct token *token, char symbol)
@@ -22,7 +24,12 @@ bool token_is_newline_or_comment(struct token *token)
 
 bool token_is_operator(struct token *token, const char *op)
 {
-    return token && token->type == TOKEN_TYPE_OPERATOR && S_EQ(token->sval, op);
+    return token && token->type == TOKEN_TYPE_OPERATOR && intern_equals(token->sval, op);
+}
+
+bool token_is_operator_id(struct token *token, int op)
+{
+    return token && token->type == TOKEN_TYPE_OPERATOR && token->op == op;
 }
 
 bool token_is_primitive_keyword(struct token *token)
@@ -37,13 +44,5 @@ bool token_is_primitive_keyword(struct token *token)
         return false;
     }
 
-    for (int i = 0; i < PRIMITIVE_TYPE_TOTAL; i++)
-    {
-        if (S_EQ(token->sval, primitive_types[i]))
-        {
-            return true;
-        }
-    }
-
-    return false;
+    return keyword_has_flag(token->keyword, KEYWORD_FLAG_PRIMITIVE);
 }
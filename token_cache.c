@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/arena.h"
+#include "helpers/hash.h"
+
+/*
+ * Lexed tokens saved to disk, for inputs that come round again unchanged.
+ *
+ * A cache file is named after its token_cache_key, a SHA-256 of the compiler
+ * binary's identity and the source's bytes, so a rebuilt compiler or a source
+ * that differs anywhere never finds another's tokens. It is laid out so that
+ * it can be mapped and read in place. Past the header it is the token store's
+ * own arrays:
+ *
+ *     header       what the tokens were lexed from, where the lexer stopped and how
+ *                  many of everything there is
+ *     wide_values  numbers too big for a payload
+ *     offsets      where every token starts
+ *     payloads     indexes into strings and wide_values, or the value itself
+ *     between      every token's between_brackets
+ *     brackets     a struct bracket_span for every bracket
+ *     open         indexes into brackets of the ones never closed, innermost last
+ *     strings      where every spelling starts in text, then the size of text
+ *     kinds        a byte for every token
+ *     text         the spellings, each followed by a NUL
+ *
+ * Nothing is used before the header has been checked against the source and
+ * the compiler, a file that doesn't match is passed over and the input lexed
+ * as usual. Files are written under a temporary name and renamed into place,
+ * so a compile running alongside never maps half a file.
+ */
+
+// Bump whenever the lexer would make different tokens out of the same source
+#define TOKEN_CACHE_VERSION 4
+#define TOKEN_CACHE_MAGIC "PEACHTOK"
+
+struct token_cache_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;  // lex_process flags the tokens were lexed with
+    char key[TOKEN_CACHE_KEY_SIZE - 1];  // the file's own name, without the NUL
+    uint64_t source_size;
+    uint64_t lexicon_hash;  // the keywords and operators the lexer knew
+    uint32_t total_tokens;
+    uint32_t total_brackets;
+    uint32_t total_strings;
+    uint32_t text_size;
+    uint32_t total_wide_values;
+    uint32_t total_open_brackets;
+    // Where the lexer stopped, a byte it can't read ends the input before source_size
+    uint32_t end_offset;
+    uint32_t end_token_offset;
+    int32_t end_line;
+    int32_t end_col;
+};
+
+// Which spellings are keywords and operators, and so which kind a token has, depends on the lexicon
+static const char token_cache_lexicon[] =
+#define KEYWORD(id, str, flags) str "\n"
+#include "keywords.def"
+#undef KEYWORD
+#define OPERATOR(id, str, precedence, associativity, flags) str " " #flags "\n"
+#include "operators.def"
+#undef OPERATOR
+    "";
+
+bool token_cache_key(struct compile_process *process, char *key)
+{
+    struct hash_sha256 sha;
+    if (!compile_cache_begin_key(&sha))
+    {
+        return false;
+    }
+
+    uint32_t version = TOKEN_CACHE_VERSION;
+    hash_sha256_update(&sha, &version, sizeof(version));
+    compile_cache_end_key(&sha, process, key);
+    return true;
+}
+
+static char *token_cache_path(const char *directory, const char *key)
+{
+    size_t size = strlen(directory) + 1 + TOKEN_CACHE_KEY_SIZE + sizeof(".tok");
+    char *path = malloc(size);
+    snprintf(path, size, "%s/%s.tok", directory, key);
+    return path;
+}
+
+static void token_cache_header_init(struct token_cache_header *header, struct lex_process *lex_process, const char *key)
+{
+    memset(header, 0, sizeof(struct token_cache_header));
+    memcpy(header->magic, TOKEN_CACHE_MAGIC, sizeof(header->magic));
+    header->version = TOKEN_CACHE_VERSION;
+    header->flags = lex_process->flags;
+    memcpy(header->key, key, sizeof(header->key));
+    header->source_size = lex_process->compiler->cfile.size;
+    header->lexicon_hash = hash_bytes64(HASH_FNV64_OFFSET_BASIS, token_cache_lexicon, sizeof(token_cache_lexicon));
+}
+
+// The parts of a mapped cache file, NULL if it isn't one for this lex_process
+struct token_cache_view
+{
+    const struct token_cache_header *header;
+    const unsigned long long *wide_values;
+    const uint32_t *offsets;
+    const uint32_t *payloads;
+    const uint32_t *between;
+    const struct bracket_span *brackets;
+    const uint32_t *open_brackets;
+    const uint32_t *strings;
+    const uint8_t *kinds;
+    const char *text;
+};
+
+static bool token_cache_view(struct token_cache_view *view, struct lex_process *lex_process, const char *key, const char *data, size_t size)
+{
+    struct token_cache_header expected;
+    token_cache_header_init(&expected, lex_process, key);
+    const struct token_cache_header *header = (const struct token_cache_header *)data;
+    if (size < sizeof(struct token_cache_header) ||
+        memcmp(header->magic, expected.magic, sizeof(expected.magic)) != 0 ||
+        header->version != expected.version ||
+        header->flags != expected.flags ||
+        memcmp(header->key, expected.key, sizeof(expected.key)) != 0 ||
+        header->source_size != expected.source_size ||
+        header->lexicon_hash != expected.lexicon_hash ||
+        header->total_tokens > INT_MAX ||
+        header->total_open_brackets > header->total_brackets ||
+        header->end_offset > header->source_size ||
+        header->end_token_offset > header->end_offset)
+    {
+        return false;
+    }
+
+    uint64_t expected_size = sizeof(struct token_cache_header) +
+                             (uint64_t)header->total_wide_values * sizeof(unsigned long long) +
+                             (uint64_t)header->total_tokens * (sizeof(uint32_t) * 3 + sizeof(uint8_t)) +
+                             (uint64_t)header->total_brackets * sizeof(struct bracket_span) +
+                             (uint64_t)header->total_open_brackets * sizeof(uint32_t) +
+                             ((uint64_t)header->total_strings + 1) * sizeof(uint32_t) +
+                             header->text_size;
+    if (size != expected_size)
+    {
+        return false;
+    }
+
+    view->header = header;
+    view->wide_values = (const unsigned long long *)(header + 1);
+    view->offsets = (const uint32_t *)(view->wide_values + header->total_wide_values);
+    view->payloads = view->offsets + header->total_tokens;
+    view->between = view->payloads + header->total_tokens;
+    view->brackets = (const struct bracket_span *)(view->between + header->total_tokens);
+    view->open_brackets = (const uint32_t *)(view->brackets + header->total_brackets);
+    view->strings = view->open_brackets + header->total_open_brackets;
+    view->kinds = (const uint8_t *)(view->strings + header->total_strings + 1);
+    view->text = (const char *)(view->kinds + header->total_tokens);
+
+    for (uint32_t i = 0; i < header->total_open_brackets; i++)
+    {
+        if (view->open_brackets[i] >= header->total_brackets)
+        {
+            return false;
+        }
+    }
+
+    // Every spelling has to lie inside text and end in its NUL
+    if (view->strings[header->total_strings] != header->text_size)
+    {
+        return false;
+    }
+    for (uint32_t i = 0; i < header->total_strings; i++)
+    {
+        uint32_t start = view->strings[i];
+        uint32_t end = view->strings[i + 1];
+        if (start >= end || end > header->text_size || view->text[end - 1] != '\0')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A store over the view's arrays, for token_store_replace to copy from. Its atoms are still to be filled in.
+static struct token_store token_cache_store(struct token_cache_view *view)
+{
+    const struct token_cache_header *header = view->header;
+    return (struct token_store){
+        .count = header->total_tokens,
+        .kinds = (uint8_t *)view->kinds,
+        .offsets = (uint32_t *)view->offsets,
+        .payloads = (uint32_t *)view->payloads,
+        .brackets = (uint32_t *)view->between,
+        .total_atoms = header->total_strings,
+        .wide_values = (unsigned long long *)view->wide_values,
+        .total_wide_values = header->total_wide_values,
+    };
+}
+
+static bool token_cache_read(struct lex_process *lex_process, struct token_cache_view *view)
+{
+    struct compile_process *compiler = lex_process->compiler;
+    const struct token_cache_header *header = view->header;
+    struct token_store cached = token_cache_store(view);
+    if (!token_store_payloads_valid(&cached))
+    {
+        return false;
+    }
+
+    const char **spellings = calloc(header->total_strings ? header->total_strings : 1, sizeof(const char *));
+    for (int i = 0; i < cached.count; i++)
+    {
+        // Comments aren't interned, the lexer gives each its own copy
+        int atom = token_store_atom(&cached, i);
+        if (token_store_type(&cached, i) == TOKEN_TYPE_COMMENT && !spellings[atom])
+        {
+            spellings[atom] = arena_strndup(compiler->arena, view->text + view->strings[atom],
+                                            view->strings[atom + 1] - view->strings[atom] - 1);
+        }
+    }
+    for (uint32_t i = 0; i < header->total_strings; i++)
+    {
+        if (!spellings[i])
+        {
+            spellings[i] = intern_string(compiler->intern_pool, view->text + view->strings[i], view->strings[i + 1] - view->strings[i] - 1);
+        }
+    }
+    cached.atoms = spellings;
+
+    struct token_store *store = lex_process->token_store;
+    token_store_reserve(store, cached.count);
+    token_store_replace(store, 0, 0, &cached, 0);
+    free(spellings);
+
+    // The newest token, for anything that looks back at it
+    if (cached.count)
+    {
+        struct token newest;
+        token_store_token(store, cached.count - 1, &newest);
+        token_vector_push(lex_process->tokens, newest);
+        lex_process->last_token_offset = token_store_offset(store, cached.count - 1);
+    }
+
+    for (uint32_t i = 0; i < header->total_brackets; i++)
+    {
+        vector_push(lex_process->brackets, (void *)&view->brackets[i]);
+    }
+    for (uint32_t i = 0; i < header->total_open_brackets; i++)
+    {
+        int index = view->open_brackets[i];
+        vector_push(lex_process->open_brackets, &index);
+    }
+    lex_process->current_expression_count = header->total_open_brackets;
+
+    lex_process->offset = header->end_offset;
+    lex_process->token_offset = header->end_token_offset;
+    lex_process->pos.line = header->end_line;
+    lex_process->pos.col = header->end_col;
+    lex_process->finished = true;
+    return true;
+}
+
+bool token_cache_load(struct lex_process *lex_process, const char *directory, const char *key)
+{
+    char *path = token_cache_path(directory, key);
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct token_cache_header))
+    {
+        data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+
+    struct token_cache_view view;
+    bool loaded = token_cache_view(&view, lex_process, key, data, (size_t)st.st_size) &&
+                  token_cache_read(lex_process, &view);
+    munmap(data, (size_t)st.st_size);
+    return loaded;
+}
+
+static bool token_cache_write(FILE *file, struct lex_process *lex_process, const char *key)
+{
+    struct token_store *store = lex_process->token_store;
+
+    // The store already holds every distinct spelling once, its atoms are the string table
+    uint32_t *strings = malloc((store->total_atoms + 1) * sizeof(uint32_t));
+    uint32_t text_size = 0;
+    for (int i = 0; i < store->total_atoms; i++)
+    {
+        strings[i] = text_size;
+        text_size += strlen(store->atoms[i]) + 1;
+    }
+    strings[store->total_atoms] = text_size;
+
+    struct token_cache_header header;
+    token_cache_header_init(&header, lex_process, key);
+    header.total_tokens = store->count;
+    header.total_brackets = vector_count(lex_process->brackets);
+    header.total_strings = store->total_atoms;
+    header.text_size = text_size;
+    header.total_wide_values = store->total_wide_values;
+    header.total_open_brackets = vector_count(lex_process->open_brackets);
+    header.end_offset = lex_process->offset;
+    header.end_token_offset = lex_process->token_offset;
+    header.end_line = lex_process->pos.line;
+    header.end_col = lex_process->pos.col;
+    fwrite(&header, sizeof(header), 1, file);
+
+    fwrite(store->wide_values, sizeof(unsigned long long), store->total_wide_values, file);
+    fwrite(store->offsets, sizeof(uint32_t), store->count, file);
+    fwrite(store->payloads, sizeof(uint32_t), store->count, file);
+    fwrite(store->brackets, sizeof(uint32_t), store->count, file);
+    fwrite(vector_data_ptr(lex_process->brackets), sizeof(struct bracket_span), header.total_brackets, file);
+    for (uint32_t i = 0; i < header.total_open_brackets; i++)
+    {
+        uint32_t index = *(int *)vector_at(lex_process->open_brackets, i);
+        fwrite(&index, sizeof(index), 1, file);
+    }
+    fwrite(strings, sizeof(uint32_t), header.total_strings + 1, file);
+    fwrite(store->kinds, sizeof(uint8_t), store->count, file);
+    for (int i = 0; i < store->total_atoms; i++)
+    {
+        fwrite(store->atoms[i], 1, strings[i + 1] - strings[i], file);
+    }
+    free(strings);
+    return !ferror(file);
+}
+
+int token_cache_save(struct lex_process *lex_process, const char *directory, const char *key)
+{
+    if (!lex_process->finished || !lex_process_keeps_token_store(lex_process))
+    {
+        return -1;
+    }
+
+    size_t size = strlen(directory) + TOKEN_CACHE_KEY_SIZE + sizeof("/..XXXXXX");
+    char *temp_path = malloc(size);
+    snprintf(temp_path, size, "%s/.%s.XXXXXX", directory, key);
+    int fd = mkstemp(temp_path);
+    if (fd < 0)
+    {
+        free(temp_path);
+        return -1;
+    }
+
+    FILE *file = fdopen(fd, "wb");
+    bool written = file && token_cache_write(file, lex_process, key);
+    if (file)
+    {
+        written = fclose(file) == 0 && written;
+    }
+    else
+    {
+        close(fd);
+    }
+
+    char *path = token_cache_path(directory, key);
+    int res = written && rename(temp_path, path) == 0 ? 0 : -1;
+    if (res != 0)
+    {
+        unlink(temp_path);
+    }
+    free(path);
+    free(temp_path);
+    return res;
+}
@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <sched.h>
+#include <assert.h>
+
+#include "compiler.h"
+
+/*
+ * Single producer, single consumer queue of token batches.
+ *
+ * The lexer thread fills a batch and publishes it by bumping published, the
+ * parser thread reads it and hands it back by bumping consumed. Both counters
+ * only ever grow and each is written by one side alone, so a release store on
+ * one side and an acquire load on the other is all the synchronisation there
+ * is. Neither side ever holds a lock, a side with nothing to do spins for a
+ * while and then yields.
+ */
+
+// Spins before a waiting side starts giving up its time slice
+#define TOKEN_QUEUE_SPINS_BEFORE_YIELD 64
+
+struct token_queue *token_queue_create()
+{
+    size_t size = (sizeof(struct token_queue) + TOKEN_QUEUE_CACHE_LINE - 1) & ~(size_t)(TOKEN_QUEUE_CACHE_LINE - 1);
+    struct token_queue *queue = aligned_alloc(TOKEN_QUEUE_CACHE_LINE, size);
+    if (!queue)
+    {
+        return NULL;
+    }
+
+    atomic_init(&queue->published, 0);
+    atomic_init(&queue->consumed, 0);
+    atomic_init(&queue->closed, false);
+    atomic_init(&queue->cancelled, false);
+    queue->failed = false;
+    queue->writing = NULL;
+    queue->reading = NULL;
+    queue->read_index = 0;
+    return queue;
+}
+
+void token_queue_free(struct token_queue *queue)
+{
+    free(queue);
+}
+
+static void token_queue_backoff(int *spins)
+{
+    if (++*spins > TOKEN_QUEUE_SPINS_BEFORE_YIELD)
+    {
+        sched_yield();
+    }
+}
+
+bool token_queue_push(struct token_queue *queue, struct token *token, uint32_t offset)
+{
+    unsigned int published = atomic_load_explicit(&queue->published, memory_order_relaxed);
+    if (!queue->writing)
+    {
+        // Wait for the consumer to hand a batch back
+        int spins = 0;
+        while (published - atomic_load_explicit(&queue->consumed, memory_order_acquire) == TOKEN_QUEUE_TOTAL_BATCHES)
+        {
+            if (atomic_load_explicit(&queue->cancelled, memory_order_acquire))
+            {
+                return false;
+            }
+            token_queue_backoff(&spins);
+        }
+        queue->writing = &queue->batches[published % TOKEN_QUEUE_TOTAL_BATCHES];
+        queue->writing->count = 0;
+    }
+
+    struct token_batch *batch = queue->writing;
+    batch->tokens[batch->count] = *token;
+    batch->offsets[batch->count] = offset;
+    batch->count++;
+    if (batch->count == TOKEN_QUEUE_BATCH_SIZE)
+    {
+        queue->writing = NULL;
+        atomic_store_explicit(&queue->published, published + 1, memory_order_release);
+    }
+    return !atomic_load_explicit(&queue->cancelled, memory_order_relaxed);
+}
+
+void token_queue_close(struct token_queue *queue, bool failed)
+{
+    if (queue->writing)
+    {
+        // Never publish an empty batch, the consumer expects at least one token in each
+        assert(queue->writing->count > 0);
+        queue->writing = NULL;
+        atomic_fetch_add_explicit(&queue->published, 1, memory_order_release);
+    }
+    queue->failed = failed;
+    atomic_store_explicit(&queue->closed, true, memory_order_release);
+}
+
+bool token_queue_pop(struct token_queue *queue, struct token *token_out, uint32_t *offset_out)
+{
+    unsigned int consumed = atomic_load_explicit(&queue->consumed, memory_order_relaxed);
+    if (!queue->reading)
+    {
+        int spins = 0;
+        while (atomic_load_explicit(&queue->published, memory_order_acquire) == consumed)
+        {
+            if (atomic_load_explicit(&queue->closed, memory_order_acquire))
+            {
+                // The last batch is published before closed is set, so one more look is enough
+                if (atomic_load_explicit(&queue->published, memory_order_acquire) == consumed)
+                {
+                    return false;
+                }
+                break;
+            }
+            token_queue_backoff(&spins);
+        }
+        queue->reading = &queue->batches[consumed % TOKEN_QUEUE_TOTAL_BATCHES];
+        queue->read_index = 0;
+    }
+
+    struct token_batch *batch = queue->reading;
+    *token_out = batch->tokens[queue->read_index];
+    *offset_out = batch->offsets[queue->read_index];
+    queue->read_index++;
+    if (queue->read_index == batch->count)
+    {
+        queue->reading = NULL;
+        atomic_store_explicit(&queue->consumed, consumed + 1, memory_order_release);
+    }
+    return true;
+}
+
+void token_queue_cancel(struct token_queue *queue)
+{
+    atomic_store_explicit(&queue->cancelled, true, memory_order_release);
+}
+
+bool token_queue_failed(struct token_queue *queue)
+{
+    // Only meaningful once the queue is closed, which orders the write before this read
+    return atomic_load_explicit(&queue->closed, memory_order_acquire) && queue->failed;
+}
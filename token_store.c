@@ -0,0 +1,426 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include "compiler.h"
+
+/*
+ * Compact token store.
+ *
+ * Tokens are kept as four parallel arrays, thirteen bytes a token:
+ *
+ *     kinds     the token type, whitespace flag and number type packed in a byte
+ *     offsets   where the token starts in the source
+ *     payloads  the value of a number or symbol, or an index into atoms for
+ *               everything that has a spelling
+ *     brackets  the token's between_brackets
+ *
+ * Line and column are not stored, token_store_pos works them out from the
+ * offset when somebody asks.
+ */
+
+#define TOKEN_STORE_INITIAL_CAPACITY 1024
+
+#define TOKEN_STORE_KIND_TYPE_MASK 0x07
+#define TOKEN_STORE_KIND_WHITESPACE 0x08
+#define TOKEN_STORE_KIND_NUMBER_TYPE_SHIFT 4
+#define TOKEN_STORE_KIND_NUMBER_TYPE_MASK 0x30
+// The payload indexes wide_values because the number did not fit in 32 bits
+#define TOKEN_STORE_KIND_WIDE 0x40
+
+struct token_store *token_store_create(const char *source, size_t size, const char *filename)
+{
+    struct token_store *store = calloc(1, sizeof(struct token_store));
+    store->source = source;
+    store->size = size;
+    store->filename = filename;
+    return store;
+}
+
+void token_store_free(struct token_store *store)
+{
+    free(store->kinds);
+    free(store->offsets);
+    free(store->payloads);
+    free(store->brackets);
+    free(store->atoms);
+    free(store->atom_slots);
+    free(store->wide_values);
+    free(store->line_starts);
+    free(store);
+}
+
+static void token_store_set_capacity(struct token_store *store, int capacity)
+{
+    store->kinds = realloc(store->kinds, capacity * sizeof(uint8_t));
+    store->offsets = realloc(store->offsets, capacity * sizeof(uint32_t));
+    store->payloads = realloc(store->payloads, capacity * sizeof(uint32_t));
+    store->brackets = realloc(store->brackets, capacity * sizeof(uint32_t));
+    assert(store->kinds && store->offsets && store->payloads && store->brackets);
+    store->capacity = capacity;
+}
+
+static void token_store_grow(struct token_store *store)
+{
+    token_store_set_capacity(store, store->capacity ? store->capacity * 2 : TOKEN_STORE_INITIAL_CAPACITY);
+}
+
+void token_store_reserve(struct token_store *store, int total_tokens)
+{
+    if (total_tokens > store->capacity)
+    {
+        token_store_set_capacity(store, total_tokens);
+    }
+}
+
+static uint32_t token_store_atom_slot(const char *str, int total_slots)
+{
+    // Atoms are aligned, the low bits of the address carry nothing.
+    return (uint32_t)(((uintptr_t)str >> 3) * 0x9e3779b1u) & (total_slots - 1);
+}
+
+static void token_store_atoms_rehash(struct token_store *store, int total_slots)
+{
+    free(store->atom_slots);
+    store->atom_slots = malloc(total_slots * sizeof(uint32_t));
+    memset(store->atom_slots, 0xff, total_slots * sizeof(uint32_t));
+    store->total_atom_slots = total_slots;
+    for (int i = 0; i < store->total_atoms; i++)
+    {
+        uint32_t slot = token_store_atom_slot(store->atoms[i], total_slots);
+        while (store->atom_slots[slot] != UINT32_MAX)
+        {
+            slot = (slot + 1) & (total_slots - 1);
+        }
+        store->atom_slots[slot] = i;
+    }
+}
+
+// Spellings are interned, so a pointer is all it takes to tell two apart.
+static uint32_t token_store_atom_index(struct token_store *store, const char *str)
+{
+    if (store->total_atoms * 2 >= store->total_atom_slots)
+    {
+        int total_slots = store->total_atom_slots ? store->total_atom_slots * 2 : 256;
+        store->atoms = realloc(store->atoms, (total_slots / 2) * sizeof(const char *));
+        token_store_atoms_rehash(store, total_slots);
+    }
+
+    uint32_t slot = token_store_atom_slot(str, store->total_atom_slots);
+    while (store->atom_slots[slot] != UINT32_MAX)
+    {
+        uint32_t index = store->atom_slots[slot];
+        if (store->atoms[index] == str)
+        {
+            return index;
+        }
+        slot = (slot + 1) & (store->total_atom_slots - 1);
+    }
+
+    uint32_t index = store->total_atoms++;
+    store->atoms[index] = str;
+    store->atom_slots[slot] = index;
+    return index;
+}
+
+static uint32_t token_store_wide_value(struct token_store *store, unsigned long long value)
+{
+    if (store->total_wide_values == store->wide_values_capacity)
+    {
+        store->wide_values_capacity = store->wide_values_capacity ? store->wide_values_capacity * 2 : 16;
+        store->wide_values = realloc(store->wide_values, store->wide_values_capacity * sizeof(unsigned long long));
+    }
+    store->wide_values[store->total_wide_values] = value;
+    return store->total_wide_values++;
+}
+
+static bool token_store_type_has_spelling(int type)
+{
+    return type == TOKEN_TYPE_IDENTIFIER ||
+           type == TOKEN_TYPE_KEYWORD ||
+           type == TOKEN_TYPE_OPERATOR ||
+           type == TOKEN_TYPE_STRING ||
+           type == TOKEN_TYPE_COMMENT;
+}
+
+void token_store_push(struct token_store *store, struct token *token, uint32_t offset)
+{
+    if (store->count == store->capacity)
+    {
+        token_store_grow(store);
+    }
+
+    uint8_t kind = token->type & TOKEN_STORE_KIND_TYPE_MASK;
+    uint32_t payload = 0;
+    if (token_store_type_has_spelling(token->type))
+    {
+        payload = token_store_atom_index(store, token->sval);
+    }
+    else if (token->type == TOKEN_TYPE_SYMBOL)
+    {
+        payload = (unsigned char)token->cval;
+    }
+    else if (token->type == TOKEN_TYPE_NUMBER)
+    {
+        kind |= (token->num.type << TOKEN_STORE_KIND_NUMBER_TYPE_SHIFT) & TOKEN_STORE_KIND_NUMBER_TYPE_MASK;
+        if (token->llnum > UINT32_MAX)
+        {
+            kind |= TOKEN_STORE_KIND_WIDE;
+            payload = token_store_wide_value(store, token->llnum);
+        }
+        else
+        {
+            payload = (uint32_t)token->llnum;
+        }
+    }
+
+    store->kinds[store->count] = kind;
+    store->offsets[store->count] = offset;
+    store->payloads[store->count] = payload;
+    store->brackets[store->count] = token->between_brackets;
+    store->count++;
+}
+
+void token_store_pop(struct token_store *store)
+{
+    assert(store->count > 0);
+    store->count--;
+}
+
+void token_store_set_whitespace(struct token_store *store, int index)
+{
+    assert(index >= 0 && index < store->count);
+    store->kinds[index] |= TOKEN_STORE_KIND_WHITESPACE;
+}
+
+void token_store_replace(struct token_store *store, int index, int total_removed, struct token_store *other, int32_t offset_delta)
+{
+    assert(index >= 0 && index + total_removed <= store->count);
+    int count = store->count - total_removed + other->count;
+    while (count > store->capacity)
+    {
+        token_store_grow(store);
+    }
+
+    // The tokens after the replaced ones keep everything but where they start
+    int total_after = store->count - index - total_removed;
+    int from = index + total_removed;
+    int to = index + other->count;
+    memmove(store->kinds + to, store->kinds + from, total_after * sizeof(uint8_t));
+    memmove(store->offsets + to, store->offsets + from, total_after * sizeof(uint32_t));
+    memmove(store->payloads + to, store->payloads + from, total_after * sizeof(uint32_t));
+    memmove(store->brackets + to, store->brackets + from, total_after * sizeof(uint32_t));
+    for (int i = to; i < to + total_after; i++)
+    {
+        store->offsets[i] += offset_delta;
+    }
+
+    // Payloads index into other's atoms and wide values, they need ours
+    for (int i = 0; i < other->count; i++)
+    {
+        uint8_t kind = other->kinds[i];
+        uint32_t payload = other->payloads[i];
+        if (token_store_type_has_spelling(kind & TOKEN_STORE_KIND_TYPE_MASK))
+        {
+            payload = token_store_atom_index(store, other->atoms[payload]);
+        }
+        else if (kind & TOKEN_STORE_KIND_WIDE)
+        {
+            payload = token_store_wide_value(store, other->wide_values[payload]);
+        }
+        store->kinds[index + i] = kind;
+        store->offsets[index + i] = other->offsets[i];
+        store->payloads[index + i] = payload;
+        store->brackets[index + i] = other->brackets[i];
+    }
+    store->count = count;
+}
+
+void token_store_set_source(struct token_store *store, const char *source, size_t size)
+{
+    store->source = source;
+    store->size = size;
+    // Lines are worked out again from the new text when next needed
+    free(store->line_starts);
+    store->line_starts = NULL;
+    store->total_lines = 0;
+}
+
+int token_store_count(struct token_store *store)
+{
+    return store->count;
+}
+
+int token_store_type(struct token_store *store, int index)
+{
+    return store->kinds[index] & TOKEN_STORE_KIND_TYPE_MASK;
+}
+
+uint32_t token_store_offset(struct token_store *store, int index)
+{
+    return store->offsets[index];
+}
+
+int token_store_atom(struct token_store *store, int index)
+{
+    if (!token_store_type_has_spelling(store->kinds[index] & TOKEN_STORE_KIND_TYPE_MASK))
+    {
+        return -1;
+    }
+    return store->payloads[index];
+}
+
+bool token_store_payloads_valid(struct token_store *store)
+{
+    for (int i = 0; i < store->count; i++)
+    {
+        uint8_t kind = store->kinds[i];
+        if (token_store_type_has_spelling(kind & TOKEN_STORE_KIND_TYPE_MASK) ?
+                store->payloads[i] >= (uint32_t)store->total_atoms :
+                (kind & TOKEN_STORE_KIND_WIDE) && store->payloads[i] >= (uint32_t)store->total_wide_values)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool token_store_is_symbol(struct token_store *store, int index, char c)
+{
+    return (store->kinds[index] & TOKEN_STORE_KIND_TYPE_MASK) == TOKEN_TYPE_SYMBOL &&
+           store->payloads[index] == (unsigned char)c;
+}
+
+bool token_store_is_operator(struct token_store *store, int index, int op)
+{
+    return (store->kinds[index] & TOKEN_STORE_KIND_TYPE_MASK) == TOKEN_TYPE_OPERATOR &&
+           store->atoms[store->payloads[index]] == operator_atom(op);
+}
+
+uint32_t token_store_between_brackets(struct token_store *store, int index)
+{
+    return store->brackets[index];
+}
+
+void token_store_set_between_brackets(struct token_store *store, int index, uint32_t between_brackets)
+{
+    assert(index >= 0 && index < store->count);
+    store->brackets[index] = between_brackets;
+}
+
+int token_store_skip_newlines_and_comments(struct token_store *store, int index)
+{
+    const uint8_t *kinds = store->kinds;
+    while (index < store->count)
+    {
+        int type = kinds[index] & TOKEN_STORE_KIND_TYPE_MASK;
+        if (type != TOKEN_TYPE_NEWLINE &&
+            type != TOKEN_TYPE_COMMENT &&
+            !(type == TOKEN_TYPE_SYMBOL && store->payloads[index] == '\\'))
+        {
+            break;
+        }
+        index++;
+    }
+    return index;
+}
+
+static void token_store_build_line_starts(struct token_store *store)
+{
+    int capacity = 256;
+    store->line_starts = malloc(capacity * sizeof(uint32_t));
+    store->line_starts[0] = 0;
+    store->total_lines = 1;
+    for (size_t i = 0; i < store->size; i++)
+    {
+        if (store->source[i] != '\n')
+        {
+            continue;
+        }
+
+        if (store->total_lines == capacity)
+        {
+            capacity *= 2;
+            store->line_starts = realloc(store->line_starts, capacity * sizeof(uint32_t));
+        }
+        store->line_starts[store->total_lines++] = i + 1;
+    }
+}
+
+struct pos token_store_pos(struct token_store *store, int index)
+{
+    return token_store_pos_at_offset(store, store->offsets[index]);
+}
+
+struct pos token_store_pos_at_offset(struct token_store *store, uint32_t offset)
+{
+    if (!store->line_starts)
+    {
+        token_store_build_line_starts(store);
+    }
+
+    // Last line that starts at or before the offset
+    int low = 0;
+    int high = store->total_lines - 1;
+    while (low < high)
+    {
+        int middle = (low + high + 1) / 2;
+        if (store->line_starts[middle] <= offset)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+
+    return (struct pos){
+        .line = low + 1,
+        .col = offset - store->line_starts[low] + 1,
+        .filename = store->filename,
+    };
+}
+
+void token_store_token(struct token_store *store, int index, struct token *token_out)
+{
+    assert(index >= 0 && index < store->count);
+    uint8_t kind = store->kinds[index];
+    uint32_t payload = store->payloads[index];
+
+    memset(token_out, 0, sizeof(struct token));
+    token_out->type = kind & TOKEN_STORE_KIND_TYPE_MASK;
+    token_out->whitespace = kind & TOKEN_STORE_KIND_WHITESPACE;
+    token_out->pos = token_store_pos(store, index);
+    token_out->between_brackets = store->brackets[index];
+    if (token_store_type_has_spelling(token_out->type))
+    {
+        token_out->sval = store->atoms[payload];
+        if (token_out->type == TOKEN_TYPE_KEYWORD)
+        {
+            token_out->keyword = keyword_lookup_hashed(token_out->sval, intern_length(token_out->sval), intern_hash(token_out->sval));
+        }
+        else if (token_out->type == TOKEN_TYPE_OPERATOR)
+        {
+            token_out->op = operator_lookup(token_out->sval, intern_length(token_out->sval));
+        }
+    }
+    else if (token_out->type == TOKEN_TYPE_SYMBOL)
+    {
+        token_out->cval = payload;
+    }
+    else if (token_out->type == TOKEN_TYPE_NUMBER)
+    {
+        token_out->num.type = (kind & TOKEN_STORE_KIND_NUMBER_TYPE_MASK) >> TOKEN_STORE_KIND_NUMBER_TYPE_SHIFT;
+        token_out->llnum = (kind & TOKEN_STORE_KIND_WIDE) ? store->wide_values[payload] : payload;
+    }
+}
+
+size_t token_store_memory_usage(struct token_store *store)
+{
+    return sizeof(struct token_store) +
+           store->capacity * (sizeof(uint8_t) + sizeof(uint32_t) * 3) +
+           (store->total_atom_slots / 2) * sizeof(const char *) +
+           store->total_atom_slots * sizeof(uint32_t) +
+           store->wide_values_capacity * sizeof(unsigned long long) +
+           store->total_lines * sizeof(uint32_t);
+}
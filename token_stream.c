@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include "compiler.h"
+#include "helpers/vector.h"
+
+/*
+ * Tokens read on demand.
+ *
+ * Rather than lexing the whole input up front, the stream asks the lexer for
+ * more whenever the parser runs off the end of what it has. Tokens sit in a
+ * ring buffer and are dropped once the parser is past them, so memory stays
+ * flat however long the input is. token_stream_save pins everything from the
+ * cursor on until the matching restore or purge, so the parser can still back
+ * up to where it saved.
+ *
+ * The lexer either runs here, a step at a time as tokens are needed, or on a
+ * thread of its own that feeds a token_queue.
+ */
+
+// How many tokens behind the cursor stay put, the parser holds on to the last few it was given
+#define TOKEN_STREAM_LOOKBEHIND 16
+
+static struct token_stream *token_stream_alloc(int capacity)
+{
+    int total = TOKEN_STREAM_LOOKBEHIND * 2;
+    while (total < capacity)
+    {
+        total *= 2;
+    }
+
+    struct token_stream *stream = calloc(1, sizeof(struct token_stream));
+    stream->tokens = malloc(total * sizeof(struct token));
+    stream->offsets = malloc(total * sizeof(uint32_t));
+    stream->capacity = total;
+    stream->saves = vector_create(sizeof(int));
+    return stream;
+}
+
+struct token_stream *token_stream_create(struct lex_process *lex_process, int capacity)
+{
+    struct token_stream *stream = token_stream_alloc(capacity);
+    stream->lex_process = lex_process;
+    stream->positions = lex_process->token_store;
+    lex_begin(lex_process);
+    stream->lexer_pos = lex_process->compiler->pos;
+    return stream;
+}
+
+// The lexer runs elsewhere and the stream only reads what it puts in the queue
+struct token_stream *token_stream_create_for_queue(struct token_queue *queue, struct token_store *positions, int capacity)
+{
+    struct token_stream *stream = token_stream_alloc(capacity);
+    stream->queue = queue;
+    stream->positions = positions;
+    return stream;
+}
+
+void token_stream_free(struct token_stream *stream)
+{
+    free(stream->tokens);
+    free(stream->offsets);
+    vector_free(stream->saves);
+    free(stream);
+}
+
+static int token_stream_slot(struct token_stream *stream, int index)
+{
+    return index & (stream->capacity - 1);
+}
+
+// Drops the tokens nobody can come back to, and grows the ring if that is not enough.
+static void token_stream_make_room(struct token_stream *stream)
+{
+    int keep_from = stream->cursor - TOKEN_STREAM_LOOKBEHIND;
+    if (vector_count(stream->saves) > 0)
+    {
+        // Saves are a stack, the first one is the oldest
+        int oldest_save = *(int *)vector_at(stream->saves, 0) - TOKEN_STREAM_LOOKBEHIND;
+        keep_from = oldest_save < keep_from ? oldest_save : keep_from;
+    }
+    if (keep_from > stream->head)
+    {
+        stream->head = keep_from;
+    }
+
+    if (stream->tail - stream->head < stream->capacity)
+    {
+        return;
+    }
+
+    // Only while a save pins more than the ring holds
+    int capacity = stream->capacity * 2;
+    struct token *tokens = malloc(capacity * sizeof(struct token));
+    uint32_t *offsets = malloc(capacity * sizeof(uint32_t));
+    for (int index = stream->head; index < stream->tail; index++)
+    {
+        tokens[index & (capacity - 1)] = stream->tokens[token_stream_slot(stream, index)];
+        offsets[index & (capacity - 1)] = stream->offsets[token_stream_slot(stream, index)];
+    }
+    free(stream->tokens);
+    free(stream->offsets);
+    stream->tokens = tokens;
+    stream->offsets = offsets;
+    stream->capacity = capacity;
+}
+
+// Moves the oldest token the lexer is done with into the ring. False at the end of the input.
+static bool token_stream_pull(struct token_stream *stream)
+{
+    struct token token;
+    uint32_t offset;
+    bool pulled;
+    if (stream->queue)
+    {
+        pulled = token_queue_pop(stream->queue, &token, &offset);
+    }
+    else
+    {
+        // Reading ahead mustn't move where the parser reports its errors. A lexing
+        // error leaves the lexer's position in place, which is where it belongs.
+        struct compile_process *compiler = stream->lex_process->compiler;
+        struct pos parser_pos = compiler->pos;
+        compiler->pos = stream->lexer_pos;
+        pulled = lex_next_token(stream->lex_process, &token, &offset);
+        stream->lexer_pos = compiler->pos;
+        compiler->pos = parser_pos;
+    }
+    if (!pulled)
+    {
+        return false;
+    }
+
+    // Where the token starts rather than where the lexer stopped, so that every mode reports the same place
+    token.pos = token_store_pos_at_offset(stream->positions, offset);
+    token_stream_make_room(stream);
+    int slot = token_stream_slot(stream, stream->tail);
+    stream->tokens[slot] = token;
+    stream->offsets[slot] = offset;
+    stream->tail++;
+    stream->total_tokens++;
+    return true;
+}
+
+struct token *token_stream_peek(struct token_stream *stream)
+{
+    while (stream->cursor >= stream->tail)
+    {
+        if (!token_stream_pull(stream))
+        {
+            return NULL;
+        }
+    }
+    return &stream->tokens[token_stream_slot(stream, stream->cursor)];
+}
+
+struct token *token_stream_next(struct token_stream *stream)
+{
+    struct token *token = token_stream_peek(stream);
+    if (token)
+    {
+        stream->cursor++;
+    }
+    return token;
+}
+
+uint32_t token_stream_last_offset(struct token_stream *stream)
+{
+    assert(stream->cursor > stream->head);
+    return stream->offsets[token_stream_slot(stream, stream->cursor - 1)];
+}
+
+void token_stream_skip_newlines_and_comments(struct token_stream *stream)
+{
+    struct token *token = token_stream_peek(stream);
+    while (token && token_is_newline_or_comment(token))
+    {
+        stream->cursor++;
+        token = token_stream_peek(stream);
+    }
+}
+
+void token_stream_save(struct token_stream *stream)
+{
+    vector_push(stream->saves, &stream->cursor);
+}
+
+void token_stream_restore(struct token_stream *stream)
+{
+    stream->cursor = *(int *)vector_back(stream->saves);
+    vector_pop(stream->saves);
+}
+
+void token_stream_save_purge(struct token_stream *stream)
+{
+    vector_pop(stream->saves);
+}
+
+size_t token_stream_memory_usage(struct token_stream *stream)
+{
+    return sizeof(struct token_stream) + stream->capacity * (sizeof(struct token) + sizeof(uint32_t));
+}
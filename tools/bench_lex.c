@@ -0,0 +1,115 @@
+/*
+ * Lexer throughput benchmark
+ *
+ *     bench_lex <file.c> [iterations]
+ *
+ * Lexes the file the given number of times and then prints one JSON object
+ * for it on stdout, with the best of those runs, so results can be collected
+ * and compared across revisions.
+ * Link with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc so allocations
+ * made while lexing can be counted.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "compiler.h"
+
+static size_t bench_allocations;
+static bool bench_counting;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    bench_allocations += bench_counting;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    bench_allocations += bench_counting;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    bench_allocations += bench_counting;
+    return __real_realloc(ptr, size);
+}
+
+static double bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <file.c> [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    const char *filename = argv[1];
+    int iterations = argc > 2 ? atoi(argv[2]) : 5;
+    if (iterations < 1)
+    {
+        iterations = 1;
+    }
+
+    double best_seconds = 0;
+    size_t bytes = 0;
+    int total_tokens = 0;
+    size_t total_allocations = 0;
+    for (int i = 0; i < iterations; i++)
+    {
+        struct compile_process *process = compile_process_create(filename, "/dev/null", 0);
+        if (!process)
+        {
+            fprintf(stderr, "Unable to open %s\n", filename);
+            return 1;
+        }
+
+        struct lex_process *lex_process = lex_process_create(process, &compiler_lex_process_functions, NULL);
+        token_store_reserve(lex_process->token_store, process->cfile.size / COMPILER_BYTES_PER_TOKEN_ESTIMATE);
+        bench_allocations = 0;
+        bench_counting = true;
+        double start = bench_now();
+        int result = lex(lex_process);
+        double seconds = bench_now() - start;
+        bench_counting = false;
+        if (result != LEX_SUCCESS)
+        {
+            fprintf(stderr, "Failed to lex %s\n", filename);
+            return 1;
+        }
+
+        if (i == 0 || seconds < best_seconds)
+        {
+            best_seconds = seconds;
+        }
+        bytes = process->cfile.size;
+        total_tokens = token_store_count(lex_process->token_store);
+        total_allocations += bench_allocations;
+
+        lex_process_free(lex_process);
+        compile_process_free(process);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("{\"benchmark\": \"lex\", \"file\": \"%s\", \"bytes\": %zu, \"tokens\": %i, \"iterations\": %i, "
+           "\"best_seconds\": %.6f, \"mb_per_s\": %.2f, \"tokens_per_s\": %.0f, "
+           "\"peak_rss_kb\": %ld, \"allocations_per_token\": %.4f}\n",
+           filename, bytes, total_tokens, iterations,
+           best_seconds, bytes / best_seconds / 1e6, total_tokens / best_seconds,
+           usage.ru_maxrss, total_tokens ? (double)total_allocations / iterations / total_tokens : 0.0);
+    return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * Vector push throughput benchmark
+ *
+ *     bench_vector [elements] [element_size]
+ *
+ * Pushes the given number of elements into a struct vector, once growing as it
+ * goes and once after vector_reserve, and compares both with the old policy of
+ * growing by VECTOR_ELEMENT_INCREMENT, which reallocated on every push. Prints
+ * one JSON object per policy on stdout.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "helpers/vector.h"
+
+static double bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_report(const char *policy, int elements, size_t element_size, double seconds, size_t reallocs)
+{
+    printf("{\"benchmark\": \"vector_push\", \"policy\": \"%s\", \"elements\": %i, \"element_size\": %zu, "
+           "\"seconds\": %.6f, \"pushes_per_s\": %.0f, \"reallocs\": %zu}\n",
+           policy, elements, element_size, seconds, elements / seconds, reallocs);
+}
+
+static void bench_vector(const char *policy, int elements, size_t element_size, bool reserve)
+{
+    char *element = calloc(1, element_size);
+    double start = bench_now();
+    struct vector *vector = vector_create(element_size);
+    if (reserve)
+    {
+        vector_reserve(vector, elements);
+    }
+
+    size_t reallocs = 0;
+    int capacity = vector->mindex;
+    for (int i = 0; i < elements; i++)
+    {
+        memcpy(element, &i, sizeof(i));
+        vector_push(vector, element);
+        if (vector->mindex != capacity)
+        {
+            capacity = vector->mindex;
+            reallocs++;
+        }
+    }
+    double seconds = bench_now() - start;
+
+    bench_report(policy, elements, element_size, seconds, reallocs);
+    vector_free(vector);
+    free(element);
+}
+
+// What vector_push used to do, a realloc to VECTOR_ELEMENT_INCREMENT past the end on every push
+static void bench_fixed_increment(int elements, size_t element_size)
+{
+    char *element = calloc(1, element_size);
+    double start = bench_now();
+    char *data = malloc(element_size * VECTOR_ELEMENT_INCREMENT);
+    int max_index = VECTOR_ELEMENT_INCREMENT;
+    size_t reallocs = 0;
+    for (int i = 0; i < elements; i++)
+    {
+        memcpy(element, &i, sizeof(i));
+        memcpy(data + i * element_size, element, element_size);
+        if (i + 1 >= max_index)
+        {
+            data = realloc(data, (i + 1 + VECTOR_ELEMENT_INCREMENT) * element_size);
+            max_index = i + 1;
+            reallocs++;
+        }
+    }
+    double seconds = bench_now() - start;
+
+    bench_report("fixed_increment", elements, element_size, seconds, reallocs);
+    free(data);
+    free(element);
+}
+
+int main(int argc, char **argv)
+{
+    int elements = argc > 1 ? atoi(argv[1]) : 1000000;
+    size_t element_size = argc > 2 ? (size_t)atoi(argv[2]) : 48;
+    if (elements < 1 || element_size < sizeof(int))
+    {
+        fprintf(stderr, "Usage: %s [elements] [element_size]\n", argv[0]);
+        return 1;
+    }
+
+    bench_fixed_increment(elements, element_size);
+    bench_vector("geometric", elements, element_size, false);
+    bench_vector("reserved", elements, element_size, true);
+    return 0;
+}
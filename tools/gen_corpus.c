@@ -0,0 +1,187 @@
+/*
+ * Synthetic C source generator for the lexer benchmarks
+ *
+ *     gen_corpus <shape> <bytes> [seed]
+ *
+ * Writes roughly bytes of source in the given shape to stdout:
+ *
+ *     identifiers   declarations and expressions over long identifiers
+ *     comments      mostly one line and multi-line comments
+ *     numbers       mostly decimal, hexadecimal and binary literals
+ *     parentheses   deeply nested parenthesized expressions
+ *     mixed         a bit of everything
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned long gen_state;
+
+static unsigned long gen_random()
+{
+    // xorshift, so the same seed always gives the same corpus
+    gen_state ^= gen_state << 13;
+    gen_state ^= gen_state >> 7;
+    gen_state ^= gen_state << 17;
+    return gen_state;
+}
+
+static size_t gen_identifier(FILE *out)
+{
+    static const char *parts[] = {"value", "count", "buffer", "index", "node", "parser", "token", "state", "result", "offset"};
+    size_t total_parts = 1 + gen_random() % 4;
+    size_t written = 0;
+    for (size_t i = 0; i < total_parts; i++)
+    {
+        written += fprintf(out, "%s%s", i ? "_" : "", parts[gen_random() % 10]);
+    }
+    // The lexer doesn't take 0 as part of an identifier, so the suffix leaves it out
+    size_t total_digits = 1 + gen_random() % 3;
+    written += fprintf(out, "_");
+    for (size_t i = 0; i < total_digits; i++)
+    {
+        written += fprintf(out, "%c", (char)('1' + gen_random() % 9));
+    }
+    return written;
+}
+
+static size_t gen_number(FILE *out)
+{
+    switch (gen_random() % 4)
+    {
+    case 0:
+        return fprintf(out, "0x%lx", gen_random() % 0xffffffff);
+    case 1:
+        return fprintf(out, "0b%lu%lu%lu%lu", gen_random() % 2, gen_random() % 2, gen_random() % 2, gen_random() % 2);
+    case 2:
+        return fprintf(out, "%luL", gen_random() % 1000000);
+    }
+    return fprintf(out, "%lu", gen_random() % 100000);
+}
+
+static size_t gen_identifiers_line(FILE *out)
+{
+    size_t written = fprintf(out, "unsigned long ");
+    written += gen_identifier(out);
+    written += fprintf(out, " = ");
+    written += gen_identifier(out);
+    written += fprintf(out, " + ");
+    written += gen_identifier(out);
+    written += fprintf(out, ";\n");
+    return written;
+}
+
+static size_t gen_comments_line(FILE *out)
+{
+    if (gen_random() % 2)
+    {
+        return fprintf(out, "// generated comment %lu explaining the next few lines of nothing in particular\n", gen_random() % 1000);
+    }
+
+    size_t written = fprintf(out, "/*\n");
+    size_t total_lines = 1 + gen_random() % 6;
+    for (size_t i = 0; i < total_lines; i++)
+    {
+        written += fprintf(out, " * block comment line %lu with some text that wraps onto the next one\n", i);
+    }
+    written += fprintf(out, " */\n");
+    return written;
+}
+
+static size_t gen_numbers_line(FILE *out)
+{
+    size_t written = fprintf(out, "int table = {");
+    size_t total_numbers = 4 + gen_random() % 12;
+    for (size_t i = 0; i < total_numbers; i++)
+    {
+        written += gen_number(out);
+        written += fprintf(out, ", ");
+    }
+    written += fprintf(out, "};\n");
+    return written;
+}
+
+static size_t gen_parentheses_line(FILE *out)
+{
+    size_t depth = 8 + gen_random() % 56;
+    size_t written = fprintf(out, "x = ");
+    for (size_t i = 0; i < depth; i++)
+    {
+        written += fprintf(out, "(a%lu + ", i % 9 + 1);
+    }
+    written += fprintf(out, "b");
+    for (size_t i = 0; i < depth; i++)
+    {
+        written += fprintf(out, ")");
+    }
+    written += fprintf(out, ";\n");
+    return written;
+}
+
+static size_t gen_mixed_line(FILE *out)
+{
+    switch (gen_random() % 4)
+    {
+    case 0:
+        return gen_identifiers_line(out);
+    case 1:
+        return gen_comments_line(out);
+    case 2:
+        return gen_numbers_line(out);
+    }
+    return gen_parentheses_line(out);
+}
+
+struct gen_shape
+{
+    const char *name;
+    size_t (*line)(FILE *out);
+};
+
+static struct gen_shape gen_shapes[] = {
+    {"identifiers", gen_identifiers_line},
+    {"comments", gen_comments_line},
+    {"numbers", gen_numbers_line},
+    {"parentheses", gen_parentheses_line},
+    {"mixed", gen_mixed_line},
+};
+
+#define TOTAL_GEN_SHAPES (sizeof(gen_shapes) / sizeof(gen_shapes[0]))
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s <identifiers|comments|numbers|parentheses|mixed> <bytes> [seed]\n", argv[0]);
+        return 1;
+    }
+
+    struct gen_shape *shape = NULL;
+    for (size_t i = 0; i < TOTAL_GEN_SHAPES; i++)
+    {
+        if (strcmp(gen_shapes[i].name, argv[1]) == 0)
+        {
+            shape = &gen_shapes[i];
+        }
+    }
+
+    if (!shape)
+    {
+        fprintf(stderr, "Unknown shape %s\n", argv[1]);
+        return 1;
+    }
+
+    size_t total_bytes = strtoull(argv[2], NULL, 10);
+    gen_state = argc > 3 ? strtoul(argv[3], NULL, 10) : 88172645463325252ul;
+    if (!gen_state)
+    {
+        gen_state = 1;
+    }
+
+    size_t written = 0;
+    while (written < total_bytes)
+    {
+        written += shape->line(stdout);
+    }
+    return 0;
+}
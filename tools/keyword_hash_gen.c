@@ -0,0 +1,102 @@
+/*
+ * Build time generator for the keyword perfect hash used by keyword.c
+ *
+ * Searches for a multiplier that maps the hash_string() of every spelling in
+ * keywords.def to its own slot, then prints the table as a C header:
+ *
+ *     slot = (hash_string(str, len) * KEYWORD_HASH_MULTIPLIER) >> (32 - KEYWORD_HASH_BITS)
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "helpers/hash.h"
+
+#define KEYWORD_HASH_GEN_MIN_BITS 6
+#define KEYWORD_HASH_GEN_MAX_BITS 12
+#define KEYWORD_HASH_GEN_ATTEMPTS_PER_SIZE 1000000
+
+struct keyword_hash_gen_entry
+{
+    const char *id;
+    const char *str;
+};
+
+static struct keyword_hash_gen_entry keywords[] = {
+#define KEYWORD(id, str, flags) {#id, str},
+#include "keywords.def"
+#undef KEYWORD
+};
+
+#define TOTAL_KEYWORDS (sizeof(keywords) / sizeof(keywords[0]))
+
+static uint32_t keyword_hash_gen_slot(uint32_t hash, uint32_t multiplier, int bits)
+{
+    return (uint32_t)(hash * multiplier) >> (32 - bits);
+}
+
+static bool keyword_hash_gen_try(uint32_t *hashes, uint32_t multiplier, int bits, int *table)
+{
+    memset(table, -1, sizeof(int) * (1 << bits));
+    for (size_t i = 0; i < TOTAL_KEYWORDS; i++)
+    {
+        uint32_t slot = keyword_hash_gen_slot(hashes[i], multiplier, bits);
+        if (table[slot] != -1)
+        {
+            return false;
+        }
+        table[slot] = i;
+    }
+    return true;
+}
+
+int main(void)
+{
+    uint32_t hashes[TOTAL_KEYWORDS];
+    for (size_t i = 0; i < TOTAL_KEYWORDS; i++)
+    {
+        hashes[i] = hash_string(keywords[i].str, strlen(keywords[i].str));
+    }
+
+    static int table[1 << KEYWORD_HASH_GEN_MAX_BITS];
+    for (int bits = KEYWORD_HASH_GEN_MIN_BITS; bits <= KEYWORD_HASH_GEN_MAX_BITS; bits++)
+    {
+        if ((1u << bits) < TOTAL_KEYWORDS)
+        {
+            continue;
+        }
+
+        // Deterministic sequence of odd multipliers, so rebuilds produce the same table
+        uint32_t multiplier = 0x9e3779b9u;
+        for (int attempt = 0; attempt < KEYWORD_HASH_GEN_ATTEMPTS_PER_SIZE; attempt++)
+        {
+            multiplier = multiplier * 1664525u + 1013904223u;
+            multiplier |= 1;
+            if (!keyword_hash_gen_try(hashes, multiplier, bits, table))
+            {
+                continue;
+            }
+
+            printf("// Generated by tools/keyword_hash_gen.c from keywords.def, do not edit.\n");
+            printf("#ifndef KEYWORD_HASH_H\n");
+            printf("#define KEYWORD_HASH_H\n\n");
+            printf("#define KEYWORD_HASH_BITS %i\n", bits);
+            printf("#define KEYWORD_HASH_MULTIPLIER 0x%08xu\n\n", multiplier);
+            printf("static const unsigned char keyword_hash_table[1 << KEYWORD_HASH_BITS] = {\n");
+            for (int slot = 0; slot < (1 << bits); slot++)
+            {
+                if (table[slot] != -1)
+                {
+                    printf("    [%i] = %s,\n", slot, keywords[table[slot]].id);
+                }
+            }
+            printf("};\n\n");
+            printf("#endif\n");
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "keyword_hash_gen: no perfect hash found for %zu keywords\n", TOTAL_KEYWORDS);
+    return 1;
+}